@@ -0,0 +1,124 @@
+// 短连接压测：每个线程循环执行 建立连接 -> 发送一个Connection: close的请求 -> 收完响应 -> 关闭，
+// 输出每秒完成的连接数以及每个连接从connect到收到完整响应的平均和最大耗时，用来对比接受新连接路径上的开销。
+// 客户端主动关闭之前服务器已经关闭了连接，本地端口不会堆积在TIME_WAIT中。
+// g++ -O2 -o accept_bench bench/accept_bench.cpp -lpthread && ./accept_bench -c 4 -d 10 10000 /index.html
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <vector>
+
+struct worker_arg {
+    pthread_t thread;
+    long completed;
+    long errors;
+    double total_us;
+    double max_us;
+};
+
+static struct sockaddr_in addr;
+static char request[256];
+static double end_time;
+
+static double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// 完成一次短连接请求，服务器发送完响应后关闭连接，读到EOF即结束
+static bool one_request()
+{
+    int fd = socket(PF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+              send(fd, request, strlen(request), 0) == (ssize_t)strlen(request);
+    char buf[4096];
+    bool got = false;
+    while (ok) {
+        int n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            ok = n == 0 && got;
+            break;
+        }
+        got = true;
+    }
+    close(fd);
+    return ok;
+}
+
+static void * worker(void * p)
+{
+    worker_arg * arg = (worker_arg *)p;
+    while (now_us() < end_time) {
+        double start = now_us();
+        if (!one_request()) {
+            ++ arg->errors;
+            continue;
+        }
+        double us = now_us() - start;
+        ++ arg->completed;
+        arg->total_us += us;
+        if (us > arg->max_us) {
+            arg->max_us = us;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char * argv[])
+{
+    int concurrency = 4;
+    int duration = 10;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:")) != -1) {
+        switch (opt) {
+            case 'c': concurrency = atoi(optarg); break;
+            case 'd': duration = atoi(optarg); break;
+            default:
+                printf("usage : %s [-c concurrency] [-d seconds] port_number [path]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind < 1 || concurrency <= 0) {
+        printf("usage : %s [-c concurrency] [-d seconds] port_number [path]\n", argv[0]);
+        return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(argv[optind]));
+    addr.sin_addr.s_addr = htonl(0x7f000001);
+    const char * path = argc - optind > 1 ? argv[optind + 1] : "/index.html";
+    snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n", path);
+
+    std::vector<worker_arg> workers(concurrency);
+    double start = now_us();
+    end_time = start + duration * 1e6;
+    for (int i = 0; i < concurrency; ++ i) {
+        memset(&workers[i], 0, sizeof(worker_arg));
+        pthread_create(&workers[i].thread, NULL, worker, &workers[i]);
+    }
+    long completed = 0, errors = 0;
+    double total_us = 0, max_us = 0;
+    for (int i = 0; i < concurrency; ++ i) {
+        pthread_join(workers[i].thread, NULL);
+        completed += workers[i].completed;
+        errors += workers[i].errors;
+        total_us += workers[i].total_us;
+        if (workers[i].max_us > max_us) {
+            max_us = workers[i].max_us;
+        }
+    }
+    double elapsed = (now_us() - start) / 1e6;
+    printf("concurrency %d, %ld connections in %.2fs, %.0f connections/s, avg %.1fus, max %.1fus, %ld errors\n",
+        concurrency, completed, elapsed, completed / elapsed, completed ? total_us / completed : 0, max_us, errors);
+    return 0;
+}
@@ -0,0 +1,114 @@
+// 连接内存占用测试：向服务器建立1k、10k、60k个连接，每一步之后读取服务器进程的常驻内存(VmRSS)。
+// 默认建立的是空闲连接，加上-a参数时每个连接发送半个请求行，使连接持有读缓冲区。
+// 本机端口不够时轮流绑定127.0.0.x作为源地址，服务器和测试程序都需要先调大文件描述符上限:
+// ulimit -n 70000 && ./server 10000 &
+// g++ -O2 -o conn_memory bench/conn_memory.cpp && ulimit -n 70000 && ./conn_memory [-a] server_pid port
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include <vector>
+
+static const int STEPS[] = { 1000, 10000, 60000 };
+static const int CONNS_PER_SOURCE = 20000; // 每个源地址建立的连接数量
+
+// 读取/proc/pid/status中的VmRSS，单位KB。文件在开始时打开，连接把描述符用完之后仍然可以读取
+static long rss_kb(int status_fd)
+{
+    char buf[4096];
+    ssize_t n = pread(status_fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+    char * line = strstr(buf, "VmRSS:");
+    return line ? atol(line + 6) : -1;
+}
+
+static int connect_one(int index, int port, bool active)
+{
+    int fd = socket(PF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(0x7f000001 + index / CONNS_PER_SOURCE);
+    if (bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        close(fd);
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(0x7f000001);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    if (active) {
+        const char * partial = "GET /index.html HTTP/1.1\r\n";
+        send(fd, partial, strlen(partial), 0);
+    }
+    return fd;
+}
+
+int main(int argc, char * argv[])
+{
+    bool active = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "a")) != -1) {
+        if (opt == 'a') {
+            active = true;
+        }
+    }
+    if (argc - optind < 2) {
+        printf("usage : %s [-a] server_pid port_number\n", argv[0]);
+        return 1;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%s/status", argv[optind]);
+    int status_fd = open(path, O_RDONLY);
+    if (status_fd < 0) {
+        printf("open %s failed: %s\n", path, strerror(errno));
+        return 1;
+    }
+    int port = atoi(argv[optind + 1]);
+
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+
+    std::vector<int> fds;
+    printf("%-12s %12s %14s\n", "connections", "rss(KB)", "per conn(B)");
+    long base = rss_kb(status_fd);
+    printf("%-12d %12ld %14s\n", 0, base, "-");
+    for (size_t i = 0; i < sizeof(STEPS) / sizeof(STEPS[0]); ++ i) {
+        while ((int)fds.size() < STEPS[i]) {
+            int fd = connect_one(fds.size(), port, active);
+            if (fd < 0) {
+                printf("connect failed after %zu connections: %s\n", fds.size(), strerror(errno));
+                break;
+            }
+            fds.push_back(fd);
+        }
+        sleep(1); // 等服务器处理完所有连接
+        long rss = rss_kb(status_fd);
+        printf("%-12zu %12ld %14ld\n", fds.size(), rss, fds.empty() ? 0 : (rss - base) * 1024 / (long)fds.size());
+        if ((int)fds.size() < STEPS[i]) {
+            break;
+        }
+    }
+    for (size_t i = 0; i < fds.size(); ++ i) {
+        close(fds[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,171 @@
+// 小文件keep-alive压测：建立若干个keep-alive连接，每个连接收到完整响应之后立即发送下一个请求，
+// 持续一段时间后输出每秒处理的请求数。用来对比连接状态重置等单个请求路径上的开销。
+// -p depth 使用HTTP/1.1流水线，每个连接一次发送depth个请求，全部响应收到之后再发送下一批。
+// 同时输出每一批请求从发送到收完全部响应的延迟(p50/p99/最大值)。
+// g++ -O2 -o keepalive_bench bench/keepalive_bench.cpp && ./keepalive_bench -c 64 -d 10 [-p 16] 10000 /index.html
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+static const int MAX_EVENT_NUMBER = 1024;
+static const int RESPONSE_BUFFER_SIZE = 64 * 1024;
+
+struct client {
+    int fd;
+    char buf[RESPONSE_BUFFER_SIZE];
+    int len;        // 已经收到的响应字节数
+    int expect;     // 完整响应的长度，响应头还没收完时为-1
+    int outstanding; // 已经发送还没有收到响应的请求数量
+    double sent_at;  // 这一批请求的发送时间
+};
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static std::string request; // 一批请求，不使用流水线时只有一个
+static int depth = 1;
+static std::vector<float> latencies; // 每一批请求的延迟，微秒
+
+static bool send_request(client & c)
+{
+    c.outstanding = depth;
+    c.sent_at = now_sec();
+    // 请求很小，一次就能写入socket发送缓冲区
+    return send(c.fd, request.data(), request.size(), 0) == (ssize_t)request.size();
+}
+
+// 解析响应头得到完整响应的长度
+static int response_length(const char * buf, int len)
+{
+    const char * end = (const char *)memmem(buf, len, "\r\n\r\n", 4);
+    if (!end) {
+        return -1;
+    }
+    const char * cl = (const char *)memmem(buf, end - buf, "Content-Length:", 15);
+    int body = cl ? atoi(cl + 15) : 0;
+    return end - buf + 4 + body;
+}
+
+int main(int argc, char * argv[])
+{
+    int connections = 64;
+    int duration = 10;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:p:")) != -1) {
+        switch (opt) {
+            case 'c': connections = atoi(optarg); break;
+            case 'd': duration = atoi(optarg); break;
+            case 'p': depth = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            default:
+                printf("usage : %s [-c connections] [-d seconds] [-p depth] port_number [path]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind < 1) {
+        printf("usage : %s [-c connections] [-d seconds] [-p depth] port_number [path]\n", argv[0]);
+        return 1;
+    }
+    int port = atoi(argv[optind]);
+    const char * path = argc - optind > 1 ? argv[optind + 1] : "/index.html";
+    char one[256];
+    snprintf(one, sizeof(one), "GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: keep-alive\r\n\r\n", path);
+    for (int i = 0; i < depth; ++ i) {
+        request += one;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(0x7f000001);
+
+    int epollfd = epoll_create(5);
+    std::vector<client *> clients;
+    for (int i = 0; i < connections; ++ i) {
+        client * c = new client;
+        c->len = 0;
+        c->expect = -1;
+        c->fd = socket(PF_INET, SOCK_STREAM, 0);
+        if (c->fd < 0 || connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            printf("connect failed: %s\n", strerror(errno));
+            return 1;
+        }
+        fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = c;
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, c->fd, &event);
+        clients.push_back(c);
+        send_request(*c);
+    }
+
+    long completed = 0;
+    long errors = 0;
+    epoll_event events[MAX_EVENT_NUMBER];
+    double start = now_sec();
+    double end = start + duration;
+    while (now_sec() < end) {
+        int num = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, 100);
+        for (int i = 0; i < num; ++ i) {
+            client * c = (client *)events[i].data.ptr;
+            int n = recv(c->fd, c->buf + c->len, RESPONSE_BUFFER_SIZE - c->len, 0);
+            if (n < 0 && errno == EAGAIN) {
+                continue;
+            }
+            if (n <= 0) {
+                // 服务器关闭了连接，不再使用这个连接
+                ++ errors;
+                epoll_ctl(epollfd, EPOLL_CTL_DEL, c->fd, NULL);
+                close(c->fd);
+                continue;
+            }
+            c->len += n;
+            // 一次可能收到多个流水线响应
+            while (true) {
+                if (c->expect < 0) {
+                    c->expect = response_length(c->buf, c->len);
+                }
+                if (c->expect < 0 || c->len < c->expect) {
+                    if (c->expect > 0 && c->len == RESPONSE_BUFFER_SIZE) {
+                        c->len = 0; // 大文件的响应体不需要保存
+                        c->expect -= RESPONSE_BUFFER_SIZE;
+                    }
+                    break;
+                }
+                c->len -= c->expect;
+                memmove(c->buf, c->buf + c->expect, c->len);
+                c->expect = -1;
+                ++ completed;
+                if (-- c->outstanding == 0) {
+                    latencies.push_back((now_sec() - c->sent_at) * 1e6);
+                    if (!send_request(*c)) {
+                        ++ errors;
+                    }
+                }
+            }
+        }
+    }
+    double elapsed = now_sec() - start;
+    printf("connections %d, depth %d, %ld requests in %.2fs, %.0f requests/s, %ld errors\n",
+        connections, depth, completed, elapsed, completed / elapsed, errors);
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+        printf("latency p50 %.0fus, p99 %.0fus, max %.0fus\n", latencies[latencies.size() / 2],
+            latencies[latencies.size() * 99 / 100], latencies.back());
+    }
+    return 0;
+}
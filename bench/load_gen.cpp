@@ -0,0 +1,555 @@
+// 通用压测程序：每个线程一个epoll循环驱动若干个连接，按请求记录延迟(HDR直方图)，输出p50/p90/p99/p999。
+// 三种用法可以组合：
+//   默认        keep-alive闭环，每个连接收到上一批响应之后立即发送下一批；
+//   -p depth    HTTP/1.1流水线，每个连接最多同时有depth个请求没有收到响应；
+//   -s          短连接，每个请求新建一个连接(Connection: close)，统计的是建立连接+请求的速率；
+//   -r rate     开环，按固定速率(每秒请求数，所有线程合计)发送，不等待响应。没有空闲连接时请求排队，
+//               延迟从计划发送的时间算起，服务器变慢时不会因为压测程序自己等待而少算延迟(coordinated omission)。
+// -w 预热的秒数，预热期间的请求不计入结果；-j 额外输出一行JSON，供bench/run_matrix.sh收集和对比。
+// -H 给每个请求加上一个头部字段，可以重复，如 -H 'Accept-Encoding: gzip' 测试压缩的响应。
+// test_presure/webbench-1.5只能做短连接、只输出每分钟页面数，保留它用于和以前的结果对比。
+// g++ -O2 -o load_gen bench/load_gen.cpp -lpthread
+//   ./load_gen -c 64 -d 10 10000 /index.html
+//   ./load_gen -c 64 -p 16 -T 2 -d 10 10000 /index.html
+//   ./load_gen -c 32 -s -r 5000 -d 10 10000 /index.html
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+static const int MAX_EVENT_NUMBER = 1024;
+static const int RESPONSE_BUFFER_SIZE = 64 * 1024;
+static const uint64_t TIMER_KEY = ~0ULL; // timerfd在epoll中的标记
+
+// HDR直方图，单位纳秒：小于2048的值精确记录，更大的值按2的幂分段，每段1024个子桶，
+// 相对误差不超过1/1024，最大约18分钟，每个线程256KB
+class histogram {
+public:
+    static const int SUB_BITS = 10;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int MAX_SHIFT = 30;
+    static const int SIZE = SUB_COUNT * (MAX_SHIFT + 2);
+
+    histogram() : m_counts(SIZE, 0), m_total(0), m_max(0) {}
+
+    void record(uint64_t ns) {
+        ++ m_counts[index_of(ns)];
+        ++ m_total;
+        if (ns > m_max) {
+            m_max = ns;
+        }
+    }
+    void merge(const histogram & other) {
+        for (int i = 0; i < SIZE; ++ i) {
+            m_counts[i] += other.m_counts[i];
+        }
+        m_total += other.m_total;
+        if (other.m_max > m_max) {
+            m_max = other.m_max;
+        }
+    }
+    uint64_t total() const {return m_total;}
+    uint64_t max() const {return m_max;}
+    // 第q分位(0~1)的值，返回所在子桶的上界，和HdrHistogram的highestEquivalentValue一致
+    uint64_t percentile(double q) const {
+        if (m_total == 0) {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(q * m_total + 0.5);
+        if (rank < 1) {
+            rank = 1;
+        }
+        uint64_t seen = 0;
+        for (int i = 0; i < SIZE; ++ i) {
+            seen += m_counts[i];
+            if (seen >= rank) {
+                uint64_t v = highest_of(i);
+                return v < m_max ? v : m_max;
+            }
+        }
+        return m_max;
+    }
+
+private:
+    static int index_of(uint64_t v) {
+        if (v < 2 * SUB_COUNT) {
+            return v;
+        }
+        int shift = 63 - __builtin_clzll(v) - SUB_BITS;
+        if (shift > MAX_SHIFT) {
+            return SIZE - 1;
+        }
+        return SUB_COUNT * shift + (int)(v >> shift);
+    }
+    static uint64_t highest_of(int index) {
+        if (index < 2 * SUB_COUNT) {
+            return index;
+        }
+        int shift = index / SUB_COUNT - 1;
+        uint64_t sub = index - SUB_COUNT * shift;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    std::vector<uint64_t> m_counts;
+    uint64_t m_total;
+    uint64_t m_max;
+};
+
+struct connection {
+    int fd;                     // 没有连接时为-1
+    uint32_t generation;        // 每次建立连接加一，用来忽略同一批事件中已经关闭的旧连接的事件
+    bool connecting;            // 正在建立连接
+    bool writing;               // 注册了EPOLLOUT，请求没有一次写完时才注册
+    std::string out;            // 还没有写入socket的请求
+    std::deque<uint64_t> starts; // 已经发送的每个请求的开始时间，按顺序对应响应
+    char buf[RESPONSE_BUFFER_SIZE];
+    int len;                    // 缓冲区中的响应字节数
+    long long expect;           // 当前响应的完整长度，响应头还没收完时为-1
+    int status;                 // 当前响应的状态码
+    bool server_close;          // 当前响应带有Connection: close
+};
+
+// 所有线程共用的参数
+static struct sockaddr_in server_addr;
+static std::string request;     // 一个请求
+static int depth = 1;
+static bool short_conn = false;
+static double rate = 0;         // 开环时所有线程合计每秒的请求数，0表示闭环
+static int warmup = 0;
+static int duration = 10;
+
+struct worker {
+    pthread_t thread;
+    int connections;
+    double rate;
+    histogram hist;
+    long long completed;
+    long long bytes;
+    long long errors;           // 连接失败或者连接被关闭时丢失的请求
+    long long non2xx;
+    long long reconnects;       // keep-alive连接被服务器正常关闭后重新连接的次数
+    long long backlog;          // 开环结束时还在排队的请求数
+};
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// 解析响应头得到完整响应的长度、状态码以及服务器是否要关闭连接
+static long long response_length(const char * buf, int len, int & status, bool & server_close)
+{
+    const char * end = (const char *)memmem(buf, len, "\r\n\r\n", 4);
+    if (!end) {
+        return -1;
+    }
+    status = len > 12 ? atoi(buf + 9) : 0;
+    server_close = memmem(buf, end - buf, "Connection: close", 17) != NULL;
+    const char * cl = (const char *)memmem(buf, end - buf, "Content-Length:", 15);
+    long long body = cl ? atoll(cl + 15) : 0;
+    return end - buf + 4 + body;
+}
+
+class load_loop {
+public:
+    load_loop(worker & w) : m_w(w), m_epollfd(epoll_create(5)), m_conns(w.connections) {
+        for (size_t i = 0; i < m_conns.size(); ++ i) {
+            m_conns[i].fd = -1;
+            m_conns[i].generation = 0;
+        }
+    }
+    ~load_loop() {
+        for (size_t i = 0; i < m_conns.size(); ++ i) {
+            if (m_conns[i].fd != -1) {
+                close(m_conns[i].fd);
+            }
+        }
+        close(m_epollfd);
+    }
+
+    void run() {
+        uint64_t start = now_ns();
+        m_measure_from = start + warmup * 1000000000ULL;
+        uint64_t end = m_measure_from + duration * 1000000000ULL;
+        uint64_t interval = m_w.rate > 0 ? (uint64_t)(1e9 / m_w.rate) : 0;
+        uint64_t next_send = start;
+        if (interval == 0) {
+            // 闭环：每个连接一开始就发出第一批请求
+            for (size_t i = 0; i < m_conns.size(); ++ i) {
+                for (int k = 0; k < (short_conn ? 1 : depth); ++ k) {
+                    issue(m_conns[i], start);
+                }
+            }
+        }
+        // 开环用timerfd按纳秒精度唤醒，epoll_wait的毫秒超时会让请求成批地晚发
+        int timerfd = -1;
+        if (interval) {
+            timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+            epoll_event event;
+            event.events = EPOLLIN;
+            event.data.u64 = TIMER_KEY;
+            epoll_ctl(m_epollfd, EPOLL_CTL_ADD, timerfd, &event);
+        }
+        epoll_event events[MAX_EVENT_NUMBER];
+        uint64_t now = start;
+        while (now < end) {
+            if (interval) {
+                // 把到期的请求交给空闲的连接，没有空闲的连接时排队
+                while (next_send <= now) {
+                    m_pending.push_back(next_send);
+                    next_send += interval;
+                }
+                drain_pending();
+                struct itimerspec when;
+                memset(&when, 0, sizeof(when));
+                when.it_value.tv_sec = next_send / 1000000000ULL;
+                when.it_value.tv_nsec = next_send % 1000000000ULL;
+                timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &when, NULL);
+            }
+            int num = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, 100);
+            for (int i = 0; i < num; ++ i) {
+                if (events[i].data.u64 == TIMER_KEY) {
+                    uint64_t expirations;
+                    ::read(timerfd, &expirations, sizeof(expirations));
+                    continue;
+                }
+                connection & c = m_conns[(uint32_t)events[i].data.u64];
+                if (c.fd == -1 || c.generation != events[i].data.u64 >> 32) {
+                    continue;
+                }
+                if (events[i].events & EPOLLOUT) {
+                    on_writable(c);
+                }
+                if (c.fd != -1 && c.generation == events[i].data.u64 >> 32 && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+                    on_readable(c);
+                }
+            }
+            now = now_ns();
+        }
+        m_w.backlog = m_pending.size();
+        if (timerfd != -1) {
+            close(timerfd);
+        }
+    }
+
+private:
+    // 开始一个请求：keep-alive连接直接追加到发送缓冲区，短连接先建立连接
+    void issue(connection & c, uint64_t start) {
+        c.starts.push_back(start);
+        if (c.fd == -1 && !open_conn(c)) {
+            return;
+        }
+        c.out += request;
+        if (!c.connecting) {
+            flush(c);
+        }
+    }
+
+    uint64_t key(connection & c) {
+        return (uint64_t)c.generation << 32 | (uint64_t)(&c - &m_conns[0]);
+    }
+
+    bool open_conn(connection & c) {
+        c.len = 0;
+        c.expect = -1;
+        c.out.clear();
+        c.fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        int one = 1;
+        setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (connect(c.fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 && errno != EINPROGRESS) {
+            fail(c);
+            return false;
+        }
+        c.connecting = true;
+        c.writing = true;
+        ++ c.generation;
+        epoll_event event;
+        event.events = EPOLLOUT;
+        event.data.u64 = key(c);
+        epoll_ctl(m_epollfd, EPOLL_CTL_ADD, c.fd, &event);
+        return true;
+    }
+
+    void close_conn(connection & c) {
+        close(c.fd); // 关闭时自动从epoll中删除
+        c.fd = -1;
+        c.connecting = false;
+    }
+
+    // 连接失败或者被关闭，已经发送的请求都算作错误
+    void fail(connection & c) {
+        if (c.fd != -1) {
+            close_conn(c);
+        }
+        m_w.errors += c.starts.size();
+        c.starts.clear();
+    }
+
+    void set_writing(connection & c, bool writing) {
+        if (c.writing == writing) {
+            return;
+        }
+        c.writing = writing;
+        epoll_event event;
+        event.events = writing ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        event.data.u64 = key(c);
+        epoll_ctl(m_epollfd, EPOLL_CTL_MOD, c.fd, &event);
+    }
+
+    void flush(connection & c) {
+        while (!c.out.empty()) {
+            ssize_t n = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EAGAIN) {
+                    set_writing(c, true);
+                    return;
+                }
+                fail(c);
+                return;
+            }
+            c.out.erase(0, n);
+        }
+        set_writing(c, false);
+    }
+
+    void on_writable(connection & c) {
+        if (c.connecting) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err) {
+                fail(c);
+                return;
+            }
+            c.connecting = false;
+        }
+        flush(c);
+    }
+
+    void on_readable(connection & c) {
+        while (true) {
+            int n = recv(c.fd, c.buf + c.len, RESPONSE_BUFFER_SIZE - c.len, 0);
+            if (n < 0 && errno == EAGAIN) {
+                return;
+            }
+            if (n <= 0) {
+                if (c.starts.empty() && c.out.empty()) {
+                    // 服务器在两个请求之间关闭了keep-alive连接(空闲超时或者请求数上限)
+                    close_conn(c);
+                    ++ m_w.reconnects;
+                    if (rate == 0) {
+                        for (int k = 0; k < depth; ++ k) {
+                            issue(c, now_ns());
+                        }
+                    }
+                } else {
+                    fail(c);
+                    refill(c);
+                }
+                return;
+            }
+            c.len += n;
+            // 一次可能收到多个流水线响应
+            while (true) {
+                if (c.expect < 0) {
+                    c.expect = response_length(c.buf, c.len, c.status, c.server_close);
+                }
+                if (c.expect < 0 || c.len < c.expect) {
+                    if (c.expect > 0 && c.len == RESPONSE_BUFFER_SIZE) {
+                        c.len = 0; // 大文件的响应体不需要保存
+                        c.expect -= RESPONSE_BUFFER_SIZE;
+                        m_w.bytes += RESPONSE_BUFFER_SIZE;
+                    }
+                    break;
+                }
+                c.len -= c.expect;
+                memmove(c.buf, c.buf + c.expect, c.len);
+                complete(c);
+                if (c.fd == -1) {
+                    return;
+                }
+            }
+        }
+    }
+
+    void complete(connection & c) {
+        uint64_t now = now_ns();
+        uint64_t start = c.starts.front();
+        c.starts.pop_front();
+        if (start >= m_measure_from) {
+            m_w.hist.record(now - start);
+            ++ m_w.completed;
+            m_w.bytes += c.expect;
+            if (c.status < 200 || c.status > 299) {
+                ++ m_w.non2xx;
+            }
+        }
+        c.expect = -1;
+        if (short_conn) {
+            close_conn(c);
+        } else if (c.server_close) {
+            // 服务器达到了每个连接的请求数上限，流水线中后面的请求在新连接上重新发送，不算错误
+            std::deque<uint64_t> rest;
+            rest.swap(c.starts);
+            close_conn(c);
+            ++ m_w.reconnects;
+            for (size_t i = 0; i < rest.size(); ++ i) {
+                issue(c, rest[i]);
+            }
+        }
+        if (c.starts.empty()) {
+            refill(c);
+        }
+    }
+
+    // 连接上的请求都完成了：闭环立即发送下一批，开环从排队的请求中取
+    void refill(connection & c) {
+        if (rate > 0) {
+            drain_pending();
+            return;
+        }
+        for (int k = 0; k < (short_conn ? 1 : depth); ++ k) {
+            issue(c, now_ns());
+        }
+    }
+
+    void drain_pending() {
+        int limit = short_conn ? 1 : depth;
+        for (size_t i = 0; i < m_conns.size() && !m_pending.empty(); ++ i) {
+            connection & c = m_conns[i];
+            while ((int)c.starts.size() < limit && !m_pending.empty()) {
+                uint64_t start = m_pending.front();
+                m_pending.pop_front();
+                issue(c, start);
+            }
+        }
+    }
+
+    worker & m_w;
+    int m_epollfd;
+    std::vector<connection> m_conns;
+    std::deque<uint64_t> m_pending; // 开环中到期但还没有发送的请求的计划时间
+    uint64_t m_measure_from;
+};
+
+static void * run_worker(void * arg)
+{
+    worker * w = (worker *)arg;
+    load_loop loop(*w);
+    loop.run();
+    return NULL;
+}
+
+static void usage(const char * name)
+{
+    printf("usage : %s [-c connections] [-T threads] [-d seconds] [-w warmup_seconds] [-p depth] [-s] [-r rate] "
+           "[-H header] [-j] [-l label] port_number [path]\n", name);
+}
+
+int main(int argc, char * argv[])
+{
+    int connections = 64;
+    int threads = 1;
+    bool json = false;
+    const char * label = "";
+    std::string headers;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:T:d:w:p:sr:H:jl:")) != -1) {
+        switch (opt) {
+            case 'c': connections = atoi(optarg); break;
+            case 'T': threads = atoi(optarg); break;
+            case 'd': duration = atoi(optarg); break;
+            case 'w': warmup = atoi(optarg); break;
+            case 'p': depth = atoi(optarg); break;
+            case 's': short_conn = true; break;
+            case 'r': rate = atof(optarg); break;
+            case 'H': headers += std::string(optarg) + "\r\n"; break;
+            case 'j': json = true; break;
+            case 'l': label = optarg; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind < 1 || connections <= 0 || threads <= 0 || depth <= 0 || duration <= 0 ||
+        warmup < 0 || rate < 0 || (short_conn && depth > 1)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (threads > connections) {
+        threads = connections;
+    }
+    int port = atoi(argv[optind]);
+    const char * path = argc - optind > 1 ? argv[optind + 1] : "/index.html";
+    request = std::string("GET ") + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: " +
+        (short_conn ? "close" : "keep-alive") + "\r\n" + headers + "\r\n";
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = htonl(0x7f000001);
+
+    // 连接和速率平均分给各个线程
+    std::vector<worker *> workers;
+    for (int i = 0; i < threads; ++ i) {
+        worker * w = new worker;
+        w->connections = connections / threads + (i < connections % threads ? 1 : 0);
+        w->rate = rate * w->connections / connections;
+        w->completed = w->bytes = w->errors = w->non2xx = w->reconnects = w->backlog = 0;
+        workers.push_back(w);
+    }
+    for (int i = 0; i < threads; ++ i) {
+        pthread_create(&workers[i]->thread, NULL, run_worker, workers[i]);
+    }
+    histogram hist;
+    long long completed = 0, bytes = 0, errors = 0, non2xx = 0, reconnects = 0, backlog = 0;
+    for (int i = 0; i < threads; ++ i) {
+        worker * w = workers[i];
+        pthread_join(w->thread, NULL);
+        hist.merge(w->hist);
+        completed += w->completed;
+        bytes += w->bytes;
+        errors += w->errors;
+        non2xx += w->non2xx;
+        reconnects += w->reconnects;
+        backlog += w->backlog;
+        delete w;
+    }
+
+    double rps = completed / (double)duration;
+    const double us = 1e-3;
+    printf("%s, connections %d, threads %d, depth %d%s, %lld requests in %ds, %.0f requests/s, %.2f MB/s\n",
+        short_conn ? "short" : "keep-alive", connections, threads, depth,
+        rate > 0 ? ", open loop" : "", completed, duration, rps, bytes / (double)duration / 1e6);
+    printf("errors %lld, non-2xx %lld, reconnects %lld%s\n", errors, non2xx, reconnects,
+        backlog ? ", requests still queued at the end (server saturated)" : "");
+    printf("latency p50 %.1fus, p90 %.1fus, p99 %.1fus, p999 %.1fus, max %.1fus\n",
+        hist.percentile(0.5) * us, hist.percentile(0.9) * us, hist.percentile(0.99) * us,
+        hist.percentile(0.999) * us, hist.max() * us);
+    if (json) {
+        printf("{\"label\":\"%s\",\"path\":\"%s\",\"mode\":\"%s\",\"connections\":%d,\"threads\":%d,\"depth\":%d,"
+               "\"rate\":%.0f,\"duration\":%d,\"requests\":%lld,\"rps\":%.1f,\"bytes\":%lld,\"errors\":%lld,"
+               "\"non2xx\":%lld,\"backlog\":%lld,\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,"
+               "\"max_us\":%.1f}\n",
+            label, path, short_conn ? "short" : "keep-alive", connections, threads, depth, rate, duration,
+            completed, rps, bytes, errors, non2xx, backlog, hist.percentile(0.5) * us, hist.percentile(0.9) * us,
+            hist.percentile(0.99) * us, hist.percentile(0.999) * us, hist.max() * us);
+    }
+    return 0;
+}
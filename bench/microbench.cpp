@@ -0,0 +1,408 @@
+// 微基准测试框架：不经过socket，直接驱动请求解析、定时器容器和线程池，输出每次操作的纳秒数。
+// 每一项先预热一轮，再重复测量若干轮(-s)，输出中位数、最小值以及中位数绝对偏差(MAD)占中位数的百分比，
+// 中位数受调度和中断的影响比平均值小得多，前后两次运行可以直接对比。主线程默认绑定到0号CPU(-c)。
+//   parse/*      http_conn::process_read + do_request(文件缓存命中)，请求来自requestdata.txt等语料，
+//                每次把请求重新拷贝进读缓冲区(解析会修改缓冲区)，拷贝也计入耗时
+//   timer/*      定时器容器在n个定时器上的混合操作：50% adjust(收到数据延长超时)、
+//                25% del + add(旧连接关闭、新连接到来)、25% tick(时间前进1ms)
+//   threadpool/* threadpool<T>::append到run处理完的每个任务的平均耗时，任务本身什么都不做
+// -f 只运行名字中包含指定字符串的项；-j 每一项额外输出一行JSON，便于保存和对比。
+// g++ -O2 -o microbench bench/microbench.cpp http_conn.cpp file_cache.cpp buffer_pool.cpp http_parser.cpp metrics.cpp logger.cpp -lpthread -lz
+// ./microbench [-s samples] [-f filter] [-c cpu] [-j] [corpus ...]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include "../http_conn.h"
+#include "../timer_wheel.h"
+#include "../threadpool.h"
+
+
+static int samples = 15;
+static const char * filter = NULL;
+static bool json = false;
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// 运行一项测试：body每次执行ops次操作
+static void run_case(const std::string & name, long ops, std::function<void()> body)
+{
+    if (filter && name.find(filter) == std::string::npos) {
+        return;
+    }
+    body(); // 预热：缓存、分支预测、内存池
+    std::vector<double> per_op(samples);
+    for (int i = 0; i < samples; ++ i) {
+        double start = now_ns();
+        body();
+        per_op[i] = (now_ns() - start) / ops;
+    }
+    std::sort(per_op.begin(), per_op.end());
+    double median = per_op[samples / 2];
+    std::vector<double> dev(samples);
+    for (int i = 0; i < samples; ++ i) {
+        dev[i] = fabs(per_op[i] - median);
+    }
+    std::sort(dev.begin(), dev.end());
+    double mad = median > 0 ? dev[samples / 2] * 100 / median : 0;
+    printf("%-36s %12.1f %12.1f %9.1f%%\n", name.c_str(), median, per_op[0], mad);
+    if (json) {
+        printf("{\"name\":\"%s\",\"ops\":%ld,\"samples\":%d,\"median_ns\":%.2f,\"min_ns\":%.2f,\"mad_pct\":%.2f}\n",
+            name.c_str(), ops, samples, median, per_op[0], mad);
+    }
+    fflush(stdout);
+}
+
+// ---------------------------------------------------------------- 请求解析
+
+// 直接操作http_conn的读缓冲区和解析状态，和process_batch()中的调用顺序相同
+class http_conn_bench {
+public:
+    explicit http_conn_bench(size_t size) {
+        m_conn.m_read_size = size;
+        m_conn.m_read_buf = buffer_pool::alloc(m_conn.m_read_size);
+        m_conn.m_cache_only = false;
+        m_conn.m_deferred = false;
+    }
+    ~http_conn_bench() {
+        buffer_pool::free(m_conn.m_read_buf, m_conn.m_read_size);
+    }
+    // 解析data中的所有请求，返回成功找到文件的请求数
+    int parse_all(const std::string & data) {
+        memcpy(m_conn.m_read_buf, data.data(), data.size());
+        m_conn.m_read_idx = data.size();
+        m_conn.m_checked_index = 0;
+        int found = 0;
+        while (m_conn.m_checked_index < m_conn.m_read_idx) {
+            m_conn.init_request();
+            if (m_conn.process_read() != http_conn::FILE_REQUEST) {
+                break;
+            }
+            file_cache::get_instance().release(m_conn.m_file);
+            m_conn.m_file = NULL;
+            ++ found;
+        }
+        return found;
+    }
+
+private:
+    http_conn m_conn;
+};
+
+// 读取语料文件，请求之间用空行分隔，换行统一成\r\n。请求目录的URL改成/index.html，保证文件缓存命中
+static void load_corpus(const char * path, std::vector<std::string> & requests)
+{
+    FILE * fp = fopen(path, "r");
+    if (!fp) {
+        printf("open %s failed\n", path);
+        return;
+    }
+    std::string request;
+    char line[8192];
+    while (fgets(line, sizeof(line), fp)) {
+        size_t n = strcspn(line, "\r\n");
+        line[n] = '\0';
+        if (request.empty() && strncmp(line, "GET / ", 6) == 0) {
+            request = "GET /index.html ";
+            request += line + 6;
+        } else {
+            request += line;
+        }
+        request += "\r\n";
+        if (n == 0) {
+            requests.push_back(request);
+            request.clear();
+        }
+    }
+    if (!request.empty()) {
+        request += "\r\n";
+        requests.push_back(request);
+    }
+    fclose(fp);
+}
+
+static void bench_parse(const std::string & name, const std::vector<std::string> & requests)
+{
+    // 一轮解析所有请求，单独的请求和16个流水线请求放在同一个缓冲区两种情况
+    std::string pipeline;
+    for (int i = 0; i < http_conn::MAX_PIPELINE; ++ i) {
+        pipeline += requests[i % requests.size()];
+    }
+    http_conn_bench bench(pipeline.size() + 1);
+    const long PARSES = 200000; // 每一轮解析的请求数
+    long rounds = PARSES / requests.size() > 0 ? PARSES / requests.size() : 1;
+    run_case("parse/" + name, rounds * requests.size(), [&]() {
+        for (long r = 0; r < rounds; ++ r) {
+            for (size_t i = 0; i < requests.size(); ++ i) {
+                if (bench.parse_all(requests[i]) != 1) {
+                    printf("request %zu of %s not parsed\n", i, name.c_str());
+                    exit(1);
+                }
+            }
+        }
+    });
+    run_case("parse/" + name + "/pipeline16", PARSES / http_conn::MAX_PIPELINE * http_conn::MAX_PIPELINE, [&]() {
+        for (long r = 0; r < PARSES / http_conn::MAX_PIPELINE; ++ r) {
+            bench.parse_all(pipeline);
+        }
+    });
+}
+
+// ---------------------------------------------------------------- 定时器
+
+static const int TIMER_OPS = 200000;
+static const time_t TIMEOUT_MIN = 5000;   // 超时时间在5~15秒之间，测量期间只有tick的时间在前进
+static const time_t TIMEOUT_SPAN = 10000;
+
+enum timer_op { OP_ADJUST, OP_CHURN, OP_TICK };
+
+struct timer_step {
+    timer_op op;
+    int index;
+    time_t timeout;
+};
+
+static std::vector<timer_step> make_steps(int n)
+{
+    std::vector<timer_step> steps(TIMER_OPS);
+    unsigned seed = 1;
+    for (int i = 0; i < TIMER_OPS; ++ i) {
+        int r = rand_r(&seed) % 4;
+        steps[i].op = r < 2 ? OP_ADJUST : (r == 2 ? OP_CHURN : OP_TICK);
+        steps[i].index = rand_r(&seed) % n;
+        steps[i].timeout = TIMEOUT_MIN + rand_r(&seed) % TIMEOUT_SPAN;
+    }
+    return steps;
+}
+
+static timer_wheel * bench_wheel = NULL;
+static time_t wheel_now = 0;
+
+// 时间轮中的定时器到期相当于连接超时关闭，马上换成一个新连接的定时器，保持定时器数量不变
+static void wheel_expired(http_conn * user_data)
+{
+    util_timer * timer = (util_timer *)user_data;
+    timer->expire = wheel_now + TIMEOUT_MIN;
+    bench_wheel->add_timer(timer);
+}
+
+static void list_expired(http_conn *)
+{
+}
+
+static void bench_timers(int n)
+{
+    std::vector<timer_step> steps = make_steps(n);
+    char name[64];
+
+    // 时间轮：定时器嵌在连接对象中，不分配内存；时间由tick(cur)直接给出
+    {
+        timer_wheel wheel;
+        bench_wheel = &wheel;
+        wheel_now = current_ms();
+        std::vector<util_timer> timers(n);
+        for (int i = 0; i < n; ++ i) {
+            timers[i].expire = wheel_now + TIMEOUT_MIN + i % TIMEOUT_SPAN;
+            timers[i].cb_func = wheel_expired;
+            timers[i].user_data = (http_conn *)&timers[i];
+            wheel.add_timer(&timers[i]);
+        }
+        snprintf(name, sizeof(name), "timer/wheel/%d", n);
+        run_case(name, TIMER_OPS, [&]() {
+            for (int i = 0; i < TIMER_OPS; ++ i) {
+                const timer_step & s = steps[i];
+                util_timer * timer = &timers[s.index];
+                switch (s.op) {
+                    case OP_ADJUST:
+                        timer->expire = wheel_now + s.timeout;
+                        wheel.adjust_timer(timer);
+                        break;
+                    case OP_CHURN:
+                        wheel.del_timer(timer);
+                        timer->expire = wheel_now + s.timeout;
+                        wheel.add_timer(timer);
+                        break;
+                    case OP_TICK:
+                        wheel.tick(++ wheel_now);
+                        break;
+                }
+            }
+        });
+        bench_wheel = NULL;
+    }
+
+    // 升序链表：和原来的服务器一样每个连接new一个定时器，del_timer时释放。tick()使用time(NULL)并释放
+    // 到期的定时器，超时时间以秒为单位，从一小时之后开始算，测量期间不会有定时器到期，tick只检查链表头
+    {
+        sort_timer_list lst;
+        time_t now = time(NULL) + 3600;
+        std::vector<util_timer *> timers(n);
+        // 按超时时间升序逐个加入，准备阶段本身不是O(n^2)
+        for (int i = 0; i < n; ++ i) {
+            util_timer * timer = new util_timer;
+            timer->expire = now + TIMEOUT_MIN / 1000 + (time_t)i * (TIMEOUT_SPAN / 1000) / n;
+            timer->cb_func = list_expired;
+            timer->user_data = NULL;
+            lst.add_timer(timer);
+            timers[i] = timer;
+        }
+        snprintf(name, sizeof(name), "timer/sort_timer_list/%d", n);
+        // adjust在链表上是O(n)，只取前面一部分操作，每一轮的时间和时间轮差不多
+        const int ops = TIMER_OPS / (n / 100);
+        run_case(name, ops, [&]() {
+            for (int i = 0; i < ops; ++ i) {
+                const timer_step & s = steps[i];
+                switch (s.op) {
+                    case OP_ADJUST:
+                        timers[s.index]->expire = now + s.timeout / 1000;
+                        lst.adjust_timer(timers[s.index]);
+                        break;
+                    case OP_CHURN:
+                    {
+                        lst.del_timer(timers[s.index]);
+                        util_timer * timer = new util_timer;
+                        timer->expire = now + s.timeout / 1000;
+                        timer->cb_func = list_expired;
+                        timer->user_data = NULL;
+                        lst.add_timer(timer);
+                        timers[s.index] = timer;
+                        break;
+                    }
+                    case OP_TICK:
+                        lst.tick();
+                        break;
+                }
+            }
+        });
+    }
+}
+
+// ---------------------------------------------------------------- 线程池
+
+static std::atomic<long> processed(0);
+
+struct bench_task {
+    bench_task() : last_worker(-1), enqueue_time(0) {}
+    void process() {
+        processed.fetch_add(1, std::memory_order_relaxed);
+    }
+    int get_last_worker() { return last_worker; }
+    void set_last_worker(int worker) { last_worker = worker; }
+    uint64_t get_enqueue_time() { return enqueue_time; }
+    void set_enqueue_time(uint64_t t) { enqueue_time = t; }
+    int last_worker;
+    uint64_t enqueue_time;
+};
+
+static void bench_threadpool(int workers, bool work_stealing)
+{
+    const int TASKS = 100000;
+    const int QUEUE_SIZE = 10000;
+    std::vector<bench_task> tasks(TASKS);
+    threadpool<bench_task> pool(workers, QUEUE_SIZE, work_stealing);
+    char name[64];
+    snprintf(name, sizeof(name), "threadpool/%s/%d", work_stealing ? "stealing" : "shared", workers);
+    // 一个生产者，和reactor线程一样逐个append，队列满时让出CPU重试；所有任务处理完才算结束
+    run_case(name, TASKS, [&]() {
+        processed.store(0);
+        for (int i = 0; i < TASKS; ++ i) {
+            while (!pool.append(&tasks[i])) {
+                sched_yield();
+            }
+        }
+        while (processed.load(std::memory_order_relaxed) < TASKS) {
+            sched_yield();
+        }
+    });
+}
+
+int main(int argc, char * argv[])
+{
+    int cpu = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:f:c:j")) != -1) {
+        switch (opt) {
+            case 's': samples = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            case 'f': filter = optarg; break;
+            case 'c': cpu = atoi(optarg); break;
+            case 'j': json = true; break;
+            default:
+                printf("usage : %s [-s samples] [-f filter] [-c cpu] [-j] [corpus ...]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        sched_setaffinity(0, sizeof(set), &set); // 之后创建的线程池工作线程也继承这个设置，在下面重新放开
+    }
+    metrics::init();
+
+    // 资源目录换成临时目录，里面只有一个index.html
+    char dir[] = "/tmp/microbench.XXXXXX";
+    if (!mkdtemp(dir)) {
+        printf("mkdtemp failed\n");
+        return 1;
+    }
+    std::string index = std::string(dir) + "/index.html";
+    FILE * fp = fopen(index.c_str(), "w");
+    fputs("<html><body>microbench</body></html>\n", fp);
+    fclose(fp);
+    http_conn::m_root = dir;
+
+    printf("%-36s %12s %12s %10s\n", "benchmark", "median ns/op", "min ns/op", "MAD");
+    std::vector<std::pair<std::string, std::vector<std::string> > > corpora;
+    std::vector<std::string> curl;
+    curl.push_back("GET /index.html HTTP/1.1\r\nHost: 127.0.0.1:10000\r\nUser-Agent: curl/7.81.0\r\nAccept: */*\r\n\r\n");
+    corpora.push_back(std::make_pair(std::string("curl"), curl));
+    if (optind >= argc) {
+        std::vector<std::string> requests;
+        load_corpus("requestdata.txt", requests);
+        corpora.push_back(std::make_pair(std::string("requestdata.txt"), requests));
+    }
+    for (int i = optind; i < argc; ++ i) {
+        std::vector<std::string> requests;
+        load_corpus(argv[i], requests);
+        corpora.push_back(std::make_pair(std::string(argv[i]), requests));
+    }
+    for (size_t i = 0; i < corpora.size(); ++ i) {
+        if (!corpora[i].second.empty()) {
+            bench_parse(corpora[i].first, corpora[i].second);
+        }
+    }
+
+    const int timer_sizes[] = { 1000, 10000 };
+    for (size_t i = 0; i < sizeof(timer_sizes) / sizeof(timer_sizes[0]); ++ i) {
+        bench_timers(timer_sizes[i]);
+    }
+
+    // 线程池的工作线程不绑定CPU，由调度器安排
+    cpu_set_t all;
+    CPU_ZERO(&all);
+    for (int i = 0; i < CPU_SETSIZE; ++ i) {
+        CPU_SET(i, &all);
+    }
+    sched_setaffinity(0, sizeof(all), &all);
+    const int workers[] = { 1, 4 };
+    for (size_t i = 0; i < sizeof(workers) / sizeof(workers[0]); ++ i) {
+        bench_threadpool(workers[i], false);
+        bench_threadpool(workers[i], true);
+    }
+
+    unlink(index.c_str());
+    rmdir(dir);
+    return 0;
+}
@@ -0,0 +1,222 @@
+// 请求解析测试：对比原来逐字节查找行尾 + strncasecmp逐个比较字段名的解析方式
+// 和find_char2向量化扫描 + lookup_header完美哈希的解析方式，输出解析每个请求的纳秒数。
+// 只测解析(切分行、解析请求行、识别头部字段)，不包括读socket和生成响应。
+// 语料文件中的请求用空行分隔，只有\n的换行会转换成\r\n，默认使用requestdata.txt，另外附带一个curl风格的短请求。
+// 编译运行: g++ -O2 -o parse_bench bench/parse_bench.cpp http_parser.cpp && ./parse_bench [corpus ...]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "../http_parser.h"
+
+static const int ROUNDS = 1000000;
+static const int BUFFER_SIZE = 16384;
+
+struct parse_result {
+    const char * url;
+    const char * host;
+    long content_length;
+    bool linger;
+    int lines;
+};
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// 解析请求行，与http_conn::parse_request_line相同
+static bool parse_request_line(char * text, parse_result & r)
+{
+    char * url = strpbrk(text, " \t");
+    if (!url) return false;
+    *url ++ = '\0';
+    if (strcasecmp(text, "GET") != 0) return false;
+    char * version = strpbrk(url, " \t");
+    if (!version) return false;
+    *version ++ = '\0';
+    if (strcasecmp(version, "HTTP/1.1") != 0) return false;
+    r.url = url;
+    return true;
+}
+
+// 原来的解析方式
+static bool parse_legacy(char * buf, int len, parse_result & r)
+{
+    int checked = 0, start = 0;
+    bool request_line = true;
+    while (true) {
+        // 逐字节查找\r\n
+        bool found = false;
+        for ( ; checked < len; ++ checked) {
+            if (buf[checked] == '\r' && checked + 1 < len && buf[checked + 1] == '\n') {
+                buf[checked++] = '\0';
+                buf[checked++] = '\0';
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            return false;
+        }
+        char * text = buf + start;
+        start = checked;
+        ++ r.lines;
+        if (request_line) {
+            if (!parse_request_line(text, r)) return false;
+            request_line = false;
+        } else if (text[0] == '\0') {
+            return true;
+        } else if (strncasecmp(text, "Connection:", 11) == 0) {
+            text += 11;
+            text += strspn(text, " \t");
+            r.linger = strcasecmp(text, "keep-alive") == 0;
+        } else if (strncasecmp(text, "Content-Length:", 15) == 0) {
+            text += 15;
+            text += strspn(text, " \t");
+            r.content_length = atol(text);
+        } else if (strncasecmp(text, "Host:", 5) == 0) {
+            text += 5;
+            text += strspn(text, " \t");
+            r.host = text;
+        }
+    }
+}
+
+// 新的解析方式，与http_conn::parse_line和parse_headers相同
+static bool parse_simd(char * buf, int len, parse_result & r)
+{
+    char * end = buf + len;
+    char * p = buf;
+    bool request_line = true;
+    while (true) {
+        char * eol = (char *)find_char2(p, end, '\r', '\n');
+        if (eol + 1 >= end || eol[0] != '\r' || eol[1] != '\n') {
+            return false;
+        }
+        eol[0] = eol[1] = '\0';
+        char * text = p;
+        p = eol + 2;
+        ++ r.lines;
+        if (request_line) {
+            if (!parse_request_line(text, r)) return false;
+            request_line = false;
+            continue;
+        }
+        if (text[0] == '\0') {
+            return true;
+        }
+        char * colon = (char *)find_char2(text, end, ':', '\0');
+        if (*colon != ':') {
+            continue;
+        }
+        char * value = colon + 1;
+        value += strspn(value, " \t");
+        switch (lookup_header(text, colon - text)) {
+            case HEADER_CONNECTION:
+                r.linger = strcasecmp(value, "keep-alive") == 0;
+                break;
+            case HEADER_CONTENT_LENGTH:
+                r.content_length = atol(value);
+                break;
+            case HEADER_HOST:
+                r.host = value;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// 读取语料文件，请求之间用空行分隔，换行统一成\r\n
+static void load_corpus(const char * path, std::vector<std::string> & requests)
+{
+    FILE * fp = fopen(path, "r");
+    if (!fp) {
+        printf("open %s failed\n", path);
+        return;
+    }
+    std::string request;
+    char line[8192];
+    while (fgets(line, sizeof(line), fp)) {
+        size_t n = strcspn(line, "\r\n");
+        line[n] = '\0';
+        request += line;
+        request += "\r\n";
+        if (n == 0) {
+            requests.push_back(request);
+            request.clear();
+        }
+    }
+    if (!request.empty()) {
+        request += "\r\n";
+        requests.push_back(request);
+    }
+    fclose(fp);
+}
+
+typedef bool (*parse_func)(char *, int, parse_result &);
+
+static double bench(parse_func parse, const std::vector<std::string> & requests, char * buf)
+{
+    long checksum = 0;
+    double start = now_ns();
+    for (int i = 0; i < ROUNDS; ++ i) {
+        const std::string & req = requests[i % requests.size()];
+        // 解析会修改缓冲区，每次重新拷贝一份，两种方式都包含这次拷贝
+        memcpy(buf, req.data(), req.size());
+        parse_result r = parse_result();
+        if (parse(buf, req.size(), r)) {
+            checksum += r.lines + r.linger + (r.host ? 1 : 0);
+        }
+    }
+    double ns = (now_ns() - start) / ROUNDS;
+    if (checksum == 0) {
+        printf("no request parsed\n");
+    }
+    return ns;
+}
+
+int main(int argc, char * argv[])
+{
+    std::vector<std::pair<std::string, std::vector<std::string> > > corpora;
+    std::vector<std::string> curl;
+    curl.push_back("GET /index.html HTTP/1.1\r\nHost: 127.0.0.1:10000\r\nUser-Agent: curl/7.81.0\r\nAccept: */*\r\n\r\n");
+    corpora.push_back(std::make_pair(std::string("curl"), curl));
+    if (argc < 2) {
+        std::vector<std::string> requests;
+        load_corpus("requestdata.txt", requests);
+        corpora.push_back(std::make_pair(std::string("requestdata.txt"), requests));
+    }
+    for (int i = 1; i < argc; ++ i) {
+        std::vector<std::string> requests;
+        load_corpus(argv[i], requests);
+        corpora.push_back(std::make_pair(std::string(argv[i]), requests));
+    }
+
+    static char buf[BUFFER_SIZE];
+    printf("%-20s %10s %14s %14s\n", "corpus", "bytes/req", "legacy ns/req", "simd ns/req");
+    for (size_t i = 0; i < corpora.size(); ++ i) {
+        const std::vector<std::string> & requests = corpora[i].second;
+        if (requests.empty()) {
+            continue;
+        }
+        size_t bytes = 0;
+        for (size_t j = 0; j < requests.size(); ++ j) {
+            if (requests[j].size() > (size_t)BUFFER_SIZE) {
+                printf("request too large in %s\n", corpora[i].first.c_str());
+                return 1;
+            }
+            bytes += requests[j].size();
+        }
+        double legacy = bench(parse_legacy, requests, buf);
+        double simd = bench(parse_simd, requests, buf);
+        printf("%-20s %10zu %14.1f %14.1f\n", corpora[i].first.c_str(), bytes / requests.size(), legacy, simd);
+    }
+    return 0;
+}
@@ -0,0 +1,17 @@
+#!/bin/bash
+# 完整的profile-guided optimization构建：插桩构建 -> 运行训练负载 -> 使用profile重新构建。
+# 两个阶段使用同一个构建目录，GCC按目标文件的路径查找对应的profile。
+#   bench/pgo_build.sh [build_dir] [其他cmake参数，如 -DWEBSERVER_LTO=ON]
+set -e
+
+SOURCE=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${1:-build-pgo}
+shift || true
+
+rm -rf "$BUILD"
+cmake -S "$SOURCE" -B "$BUILD" -DCMAKE_BUILD_TYPE=Release -DWEBSERVER_PGO=generate "$@"
+cmake --build "$BUILD" -j"$(nproc)"
+cmake --build "$BUILD" --target pgo_train
+cmake -S "$SOURCE" -B "$BUILD" -DWEBSERVER_PGO=use
+cmake --build "$BUILD" -j"$(nproc)"
+echo "optimized server: $BUILD/server"
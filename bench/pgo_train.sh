@@ -0,0 +1,29 @@
+#!/bin/bash
+# profile-guided optimization的训练负载：用插桩构建的服务器依次以几种常用的配置启动，
+# 每种配置用bench/run_matrix.sh跑一遍较小的矩阵(keep-alive、流水线、短连接，小文件到大文件)，
+# 服务器收到SIGTERM正常退出时写出profile，多次运行的计数会累加。由CMake的pgo_train目标调用：
+#   bench/pgo_train.sh server_binary load_gen_binary
+set -e
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+if [ $# -lt 2 ]; then
+    echo "usage: $0 server_binary load_gen_binary"
+    exit 1
+fi
+SERVER=$1
+export LOAD_GEN=$2
+export SIZES=${SIZES:-"1k 16k 1m"}
+export CONNS=${CONNS:-"8 64"}
+export WARMUP=0
+DURATION=${DURATION:-2}
+PORT=${PORT:-10090}
+
+# 单reactor + 线程池、多reactor + 缓存命中在reactor线程处理、io_uring后端(内核不支持时服务器退回epoll)
+while read -r options; do
+    echo "== training: server $options" >&2
+    "$DIR/run_matrix.sh" -d "$DURATION" -p "$PORT" -o /dev/null "$SERVER" $options
+done <<OPTIONS
+-t 4
+-r 2 -t 4 -i -m /metrics
+-u -r 2
+OPTIONS
@@ -0,0 +1,133 @@
+#!/bin/bash
+# 压测矩阵：在本机启动服务器，对 文件大小 × 并发连接数 × 模式(keep-alive/流水线/短连接) 逐项运行bench/load_gen，
+# 每一项输出一行JSON(load_gen -j)追加到结果文件。指定 -b 时和之前的结果文件逐项对比吞吐量和p99延迟。
+#   bench/run_matrix.sh [-o results.jsonl] [-b baseline.jsonl] [-d seconds] [-p port] ./server [server_options]
+# 可以用环境变量调整矩阵：
+#   SIZES="1k 16k 256k 4m"  CONNS="1 16 64 256"  MODES="keep-alive pipeline short"  DEPTH=16  WARMUP=1
+#   ROOT  服务器的资源目录，通过-d传给服务器，测试文件bench_<size>.bin生成在这里，结束后删除。默认用一个临时目录
+#   LOAD_GEN  load_gen的路径，不指定时编译bench/load_gen.cpp
+#   WEBBENCH  webbench的路径，指定时对每个文件大小额外运行一次webbench短连接测试，结果同样记为一行JSON
+set -e
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+OUTPUT=results.jsonl
+BASELINE=
+DURATION=5
+PORT=10080
+while getopts "o:b:d:p:" opt; do
+    case $opt in
+        o) OUTPUT=$OPTARG ;;
+        b) BASELINE=$OPTARG ;;
+        d) DURATION=$OPTARG ;;
+        p) PORT=$OPTARG ;;
+        *) exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+if [ $# -lt 1 ]; then
+    echo "usage: $0 [-o results.jsonl] [-b baseline.jsonl] [-d seconds] [-p port] server_binary [server_options]"
+    exit 1
+fi
+SERVER=$1
+shift
+
+SIZES=${SIZES:-"1k 16k 256k 4m"}
+CONNS=${CONNS:-"1 16 64 256"}
+MODES=${MODES:-"keep-alive pipeline short"}
+DEPTH=${DEPTH:-16}
+WARMUP=${WARMUP:-1}
+ROOT_CREATED=
+if [ -z "$ROOT" ]; then
+    ROOT=$(mktemp -d)
+    ROOT_CREATED=1
+fi
+
+if [ -z "$LOAD_GEN" ]; then
+    LOAD_GEN=$(mktemp)
+    g++ -O2 -o "$LOAD_GEN" "$DIR/load_gen.cpp" -lpthread
+fi
+
+SERVER_PID=
+cleanup() {
+    if [ -n "$SERVER_PID" ]; then
+        kill "$SERVER_PID" 2>/dev/null || true
+        wait "$SERVER_PID" 2>/dev/null || true
+    fi
+    for size in $SIZES; do
+        rm -f "$ROOT/bench_$size.bin"
+    done
+    if [ -n "$ROOT_CREATED" ]; then
+        rmdir "$ROOT" 2>/dev/null || true
+    fi
+}
+trap cleanup EXIT
+
+mkdir -p "$ROOT"
+for size in $SIZES; do
+    head -c "$(numfmt --from=iec "${size^^}")" /dev/urandom > "$ROOT/bench_$size.bin"
+done
+
+"$SERVER" -d "$ROOT" "$@" "$PORT" > /dev/null 2>&1 &
+SERVER_PID=$!
+for i in $(seq 50); do
+    if (exec 3<>"/dev/tcp/127.0.0.1/$PORT") 2>/dev/null; then
+        break
+    fi
+    sleep 0.1
+done
+
+: > "$OUTPUT"
+for size in $SIZES; do
+    path=/bench_$size.bin
+    for conns in $CONNS; do
+        for mode in $MODES; do
+            case $mode in
+                keep-alive) args="" ;;
+                pipeline) args="-p $DEPTH" ;;
+                short) args="-s" ;;
+                *) echo "unknown mode $mode"; exit 1 ;;
+            esac
+            label="$mode/$size/c$conns"
+            echo "== $label" >&2
+            "$LOAD_GEN" -c "$conns" -d "$DURATION" -w "$WARMUP" $args -j -l "$label" "$PORT" "$path" | grep '^{' >> "$OUTPUT"
+        done
+    done
+    if [ -n "$WEBBENCH" ]; then
+        # webbench只报告每分钟的页面数，换算成每秒请求数，没有延迟
+        conns=$(echo $CONNS | awk '{print $NF}')
+        label="webbench/$size/c$conns"
+        echo "== $label" >&2
+        "$WEBBENCH" -c "$conns" -t "$DURATION" -2 "http://127.0.0.1:$PORT$path" 2>&1 |
+            awk -v label="$label" -v path="$path" -v c="$conns" -v d="$DURATION" '
+                /pages\/min/ { speed = $1; sub("Speed=", "", speed) }
+                /Requests:/ { failed = $(NF - 1) }
+                END { printf("{\"label\":\"%s\",\"path\":\"%s\",\"mode\":\"webbench\",\"connections\":%d,\"duration\":%d,\"rps\":%.1f,\"errors\":%d}\n",
+                             label, path, c, d, speed / 60, failed) }' >> "$OUTPUT"
+    fi
+done
+
+echo "results written to $OUTPUT" >&2
+
+# 和基准结果逐项对比：吞吐量和p99延迟的变化
+if [ -n "$BASELINE" ]; then
+    awk '
+        function field(line, name,    m) {
+            if (match(line, "\"" name "\":\"?[^,\"}]*")) {
+                m = substr(line, RSTART, RLENGTH)
+                sub("\"" name "\":\"?", "", m)
+                return m
+            }
+            return ""
+        }
+        FNR == NR { rps[field($0, "label")] = field($0, "rps"); p99[field($0, "label")] = field($0, "p99_us"); next }
+        {
+            label = field($0, "label")
+            if (!(label in rps)) next
+            r = field($0, "rps"); p = field($0, "p99_us")
+            printf("%-28s rps %10.0f -> %10.0f (%+6.1f%%)", label, rps[label], r, rps[label] > 0 ? (r - rps[label]) * 100 / rps[label] : 0)
+            if (p != "" && p99[label] != "") {
+                printf("   p99 %9.1fus -> %9.1fus (%+6.1f%%)", p99[label], p, p99[label] > 0 ? (p - p99[label]) * 100 / p99[label] : 0)
+            }
+            printf("\n")
+        }' "$BASELINE" "$OUTPUT"
+fi
@@ -0,0 +1,147 @@
+// 系统调用计数：用ptrace跟踪服务器进程的所有线程，统计跟踪期间每种系统调用的次数。
+// 配合压测程序使用，总次数除以压测程序输出的请求数就是每个请求的系统调用次数：
+//   ./syscall_count server_pid & ./keepalive_bench -c 64 -d 5 10000; kill -INT %1
+// 跟踪会让服务器慢很多，只用来数次数，不要同时看吞吐量。跟踪开始之后新建的线程不会被跟踪。
+// g++ -O2 -o syscall_count bench/syscall_count.cpp
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <map>
+#include <vector>
+#include <algorithm>
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int)
+{
+    stop = 1;
+}
+
+struct syscall_name {
+    long nr;
+    const char * name;
+};
+
+// 服务器用到的系统调用，其他的只输出编号
+static const syscall_name names[] = {
+    { SYS_read, "read" }, { SYS_write, "write" }, { SYS_close, "close" },
+    { SYS_recvfrom, "recvfrom" }, { SYS_sendto, "sendto" }, { SYS_sendmsg, "sendmsg" },
+    { SYS_sendfile, "sendfile" }, { SYS_accept4, "accept4" }, { SYS_shutdown, "shutdown" },
+    { SYS_epoll_wait, "epoll_wait" }, { SYS_epoll_ctl, "epoll_ctl" }, { SYS_futex, "futex" },
+    { SYS_setsockopt, "setsockopt" }, { SYS_fcntl, "fcntl" }, { SYS_timerfd_settime, "timerfd_settime" },
+    { SYS_io_uring_enter, "io_uring_enter" }, { SYS_fadvise64, "fadvise64" }, { SYS_writev, "writev" },
+#ifdef SYS_epoll_pwait
+    { SYS_epoll_pwait, "epoll_pwait" },
+#endif
+};
+
+static const char * name_of(long nr)
+{
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++ i) {
+        if (names[i].nr == nr) {
+            return names[i].name;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char * argv[])
+{
+    if (argc < 2) {
+        printf("usage : %s pid\n", argv[0]);
+        return 1;
+    }
+    pid_t pid = atoi(argv[1]);
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    DIR * dir = opendir(path);
+    if (!dir) {
+        printf("open %s failed\n", path);
+        return 1;
+    }
+    std::vector<pid_t> tids;
+    struct dirent * ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+        pid_t tid = atoi(ent->d_name);
+        // PTRACE_O_TRACESYSGOOD: 系统调用引起的停止带上0x80，和真正的SIGTRAP区分开
+        if (ptrace(PTRACE_SEIZE, tid, NULL, (void *)PTRACE_O_TRACESYSGOOD) < 0) {
+            printf("attach %d failed: %s\n", tid, strerror(errno));
+            return 1;
+        }
+        ptrace(PTRACE_INTERRUPT, tid, NULL, NULL);
+        tids.push_back(tid);
+    }
+    closedir(dir);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    std::map<long, long> counts;
+    long total = 0;
+    size_t detached = 0;
+    while (detached < tids.size()) {
+        int status;
+        pid_t tid = waitpid(-1, &status, __WALL);
+        if (tid < 0) {
+            if (errno == EINTR) {
+                // 通知所有线程停下来，停下之后逐个脱离
+                for (size_t i = 0; i < tids.size(); ++ i) {
+                    ptrace(PTRACE_INTERRUPT, tids[i], NULL, NULL);
+                }
+                continue;
+            }
+            break;
+        }
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            ++ detached;
+            continue;
+        }
+        if (stop) {
+            ptrace(PTRACE_DETACH, tid, NULL, NULL);
+            ++ detached;
+            continue;
+        }
+        int sig = 0;
+        if (WIFSTOPPED(status) && WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+            // 只在进入系统调用时计数
+            struct __ptrace_syscall_info info;
+            if (ptrace(PTRACE_GET_SYSCALL_INFO, tid, sizeof(info), &info) > 0 &&
+                info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+                ++ counts[info.entry.nr];
+                ++ total;
+            }
+        } else if (WIFSTOPPED(status) && (status >> 16) == 0 && WSTOPSIG(status) != SIGTRAP) {
+            sig = WSTOPSIG(status); // 把信号原样交给进程
+        }
+        ptrace(PTRACE_SYSCALL, tid, NULL, (void *)(long)sig);
+    }
+
+    std::vector<std::pair<long, long> > sorted;
+    for (std::map<long, long>::iterator it = counts.begin(); it != counts.end(); ++ it) {
+        sorted.push_back(std::make_pair(it->second, it->first));
+    }
+    std::sort(sorted.rbegin(), sorted.rend());
+    printf("total %ld syscalls\n", total);
+    for (size_t i = 0; i < sorted.size(); ++ i) {
+        const char * name = name_of(sorted[i].second);
+        if (name) {
+            printf("%10ld  %s\n", sorted[i].first, name);
+        } else {
+            printf("%10ld  syscall %ld\n", sorted[i].first, sorted[i].second);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,145 @@
+// 线程池任务队列的竞争测试：对比原来的 std::list + 互斥锁 + 信号量 实现、无锁环形队列 + futex 实现
+// 以及每个线程一个队列的work_stealing模式，
+// 在不同的生产者/工作线程数量下每秒能处理的任务数。任务本身几乎不做事，测的就是队列的开销。
+// 编译运行: g++ -O2 -o threadpool_bench bench/threadpool_bench.cpp metrics.cpp logger.cpp -lpthread && ./threadpool_bench
+#include <stdio.h>
+#include <time.h>
+#include <sched.h>
+#include <list>
+#include <atomic>
+#include "../threadpool.h"
+
+static const long TASKS = 1000000; // 每一轮的任务总数
+static const int QUEUE_SIZE = 10000;
+
+// 原来的线程池实现，作为对比的基准
+template< typename T >
+class legacy_threadpool {
+public:
+    legacy_threadpool(int thread_number, int max_requests) : m_max_request(max_requests) {
+        for (int i = 0; i < thread_number; ++ i) {
+            pthread_t tid;
+            pthread_create(&tid, NULL, worker, (void *)this);
+            pthread_detach(tid);
+        }
+    }
+    bool append(T * request) {
+        m_queuelocker.lock();
+        if (m_workqueue.size() > (size_t)m_max_request) {
+            m_queuelocker.unlock();
+            return false;
+        }
+        m_workqueue.push_back(request);
+        m_queuelocker.unlock();
+        m_queuestat.post();
+        return true;
+    }
+private:
+    static void * worker(void * arg) {
+        legacy_threadpool * pool = (legacy_threadpool *)arg;
+        while (true) {
+            pool->m_queuestat.wait();
+            pool->m_queuelocker.lock();
+            if (pool->m_workqueue.empty()) {
+                pool->m_queuelocker.unlock();
+                continue;
+            }
+            T * request = pool->m_workqueue.front();
+            pool->m_workqueue.pop_front();
+            pool->m_queuelocker.unlock();
+            request->process();
+        }
+        return NULL;
+    }
+    int m_max_request;
+    std::list<T*> m_workqueue;
+    locker m_queuelocker;
+    sem m_queuestat;
+};
+
+static std::atomic<long> done(0);
+
+struct task {
+    void process() {
+        done.fetch_add(1, std::memory_order_relaxed);
+    }
+    int get_last_worker() { return -1; }
+    void set_last_worker(int) {}
+    uint64_t get_enqueue_time() { return 0; }
+    void set_enqueue_time(uint64_t) {}
+};
+
+static task the_task;
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+template< typename P >
+struct producer_arg {
+    P * pool;
+    long count;
+};
+
+// 生产者相当于reactor线程，队列满时让出CPU之后重试
+template< typename P >
+static void * produce(void * arg)
+{
+    producer_arg<P> * p = (producer_arg<P> *)arg;
+    for (long i = 0; i < p->count; ++ i) {
+        while (!p->pool->append(&the_task)) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+template< typename P >
+static double run(P * pool, int producers)
+{
+    done = 0;
+    pthread_t tids[16];
+    producer_arg<P> arg;
+    arg.pool = pool;
+    arg.count = TASKS / producers;
+    double start = now_sec();
+    for (int i = 0; i < producers; ++ i) {
+        pthread_create(&tids[i], NULL, produce<P>, &arg);
+    }
+    for (int i = 0; i < producers; ++ i) {
+        pthread_join(tids[i], NULL);
+    }
+    long total = arg.count * producers;
+    while (done.load() < total) {
+        sched_yield();
+    }
+    return total / (now_sec() - start);
+}
+
+int main()
+{
+    const int workers[] = { 1, 2, 4, 8, 16 };
+    const int producers[] = { 1, 4 };
+    printf("%-10s %-8s %18s %18s %18s\n", "producers", "workers", "legacy tasks/s", "lockfree tasks/s", "stealing tasks/s");
+    for (size_t p = 0; p < sizeof(producers) / sizeof(producers[0]); ++ p) {
+        for (size_t w = 0; w < sizeof(workers) / sizeof(workers[0]); ++ w) {
+            // 原来的实现中工作线程是detach的，析构之后仍会访问线程池，这里不释放
+            legacy_threadpool<task> * legacy = new legacy_threadpool<task>(workers[w], QUEUE_SIZE);
+            double legacy_rate = run(legacy, producers[p]);
+
+            threadpool<task> * pool = new threadpool<task>(workers[w], QUEUE_SIZE);
+            double rate = run(pool, producers[p]);
+            delete pool;
+
+            threadpool<task> * stealing = new threadpool<task>(workers[w], QUEUE_SIZE, true);
+            double stealing_rate = run(stealing, producers[p]);
+            delete stealing;
+
+            printf("%-10d %-8d %18.0f %18.0f %18.0f\n", producers[p], workers[w], legacy_rate, rate, stealing_rate);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+// 定时器容器的微基准测试：对比升序链表sort_timer_list和分层时间轮timer_wheel
+// 在10k/100k个定时器时add/adjust/del/tick的单次耗时。
+// 编译运行: g++ -O2 -o timer_bench bench/timer_bench.cpp && ./timer_bench
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+#include "../http_conn.h"
+#include "../timer_wheel.h"
+
+static const int OPS = 2000; // add/adjust/del各执行的次数
+static long fired = 0;
+
+static void bench_cb(http_conn*)
+{
+    ++ fired;
+}
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static util_timer* make_timer(time_t expire)
+{
+    util_timer* timer = new util_timer;
+    timer->expire = expire;
+    timer->cb_func = bench_cb;
+    timer->user_data = NULL;
+    return timer;
+}
+
+struct result {
+    double add;
+    double adjust;
+    double del;
+    double tick;
+};
+
+// 预先放入n个超时时间分布在之后60秒内的定时器，然后分别测量
+// 新连接添加定时器(超时时间最晚)、收到数据延长超时时间、删除定时器、全部到期各自的单次耗时
+template< typename C >
+static result run(C& container, int n, time_t now, bool sorted_setup)
+{
+    result r;
+    std::vector<util_timer*> timers(n);
+    for (int i = 0; i < n; ++ i) {
+        timers[i] = make_timer(now + 1 + (long long)i * 60000 / n);
+    }
+    // 链表按降序插入，每次都插在头部，避免准备阶段本身就是O(n^2)
+    for (int i = n - 1; i >= 0; -- i) {
+        container.add_timer(sorted_setup ? timers[i] : timers[n - 1 - i]);
+    }
+
+    double start = now_ns();
+    for (int i = 0; i < OPS; ++ i) {
+        util_timer* timer = make_timer(now + 60000);
+        container.add_timer(timer);
+        timers.push_back(timer);
+    }
+    r.add = (now_ns() - start) / OPS;
+
+    std::vector<int> picks(OPS);
+    for (int i = 0; i < OPS; ++ i) {
+        picks[i] = rand() % n;
+    }
+    start = now_ns();
+    for (int i = 0; i < OPS; ++ i) {
+        util_timer* timer = timers[picks[i]];
+        timer->expire = now + 90000 + i; // 超时时间只会延长
+        container.adjust_timer(timer);
+    }
+    r.adjust = (now_ns() - start) / OPS;
+
+    std::sort(picks.begin(), picks.end());
+    picks.erase(std::unique(picks.begin(), picks.end()), picks.end());
+    start = now_ns();
+    for (size_t i = 0; i < picks.size(); ++ i) {
+        container.del_timer(timers[picks[i]]);
+        timers[picks[i]] = NULL;
+    }
+    r.del = (now_ns() - start) / picks.size();
+
+    // 所有定时器的超时时间统一前移，保持链表的有序性，然后一次tick全部到期
+    long remain = 0;
+    for (size_t i = 0; i < timers.size(); ++ i) {
+        if (timers[i]) {
+            timers[i]->expire -= 1000000;
+            ++ remain;
+        }
+    }
+    fired = 0;
+    start = now_ns();
+    container.tick();
+    r.tick = (now_ns() - start) / remain;
+    if (fired != remain) {
+        printf("expected %ld timers to fire, got %ld\n", remain, fired);
+    }
+    return r;
+}
+
+// 时间轮的tick需要走过中间的每一个时间单位，这里的适配器把当前时间拨到所有定时器之后
+class wheel_adapter : public timer_wheel {
+public:
+    explicit wheel_adapter(time_t until) : m_until(until) {}
+    void tick() { timer_wheel::tick(m_until); }
+private:
+    time_t m_until;
+};
+
+int main()
+{
+    srand(1);
+    const int sizes[] = { 10000, 100000 };
+    printf("%-8s %-16s %12s %12s %12s %12s\n", "timers", "container", "add ns", "adjust ns", "del ns", "tick ns");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++ i) {
+        int n = sizes[i];
+        time_t now = current_ms();
+        {
+            sort_timer_list lst;
+            result r = run(lst, n, now, true);
+            printf("%-8d %-16s %12.1f %12.1f %12.1f %12.1f\n", n, "sort_timer_list", r.add, r.adjust, r.del, r.tick);
+        }
+        {
+            wheel_adapter wheel(now + 200000);
+            result r = run(wheel, n, now, false);
+            printf("%-8d %-16s %12.1f %12.1f %12.1f %12.1f\n", n, "timer_wheel", r.add, r.adjust, r.del, r.tick);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include "buffer_pool.h"
+#include "locker.h"
+#include <stdlib.h>
+
+static const int SLAB_SIZE = 64 * 1024;     // 每次向系统申请的内存大小
+static const int CACHE_LIMIT = 64;          // 每个线程每个等级最多缓存的缓冲区数量
+
+// 空闲的缓冲区本身用来保存链表指针
+struct free_chunk {
+    free_chunk * next;
+};
+
+struct chunk_list {
+    free_chunk * head;
+    int count;
+};
+
+// 全局的空闲链表，每个等级一把锁
+static chunk_list global_free[buffer_pool::CLASS_NUMBER];
+static locker global_locker[buffer_pool::CLASS_NUMBER];
+
+// 线程本地缓存
+static thread_local chunk_list local_free[buffer_pool::CLASS_NUMBER];
+
+static int size_class(int size)
+{
+    int cls = 0;
+    int chunk = buffer_pool::MIN_CHUNK_SIZE;
+    while (chunk < size) {
+        chunk <<= 1;
+        ++ cls;
+    }
+    return cls;
+}
+
+// 从全局链表中取一批缓冲区放到本线程缓存中，全局链表为空时切分一个新的slab
+static bool refill(int cls)
+{
+    int chunk = buffer_pool::MIN_CHUNK_SIZE << cls;
+    chunk_list & local = local_free[cls];
+    global_locker[cls].lock();
+    while (global_free[cls].head && local.count < CACHE_LIMIT / 2) {
+        free_chunk * c = global_free[cls].head;
+        global_free[cls].head = c->next;
+        -- global_free[cls].count;
+        c->next = local.head;
+        local.head = c;
+        ++ local.count;
+    }
+    global_locker[cls].unlock();
+    if (local.head) {
+        return true;
+    }
+    char * slab = (char *)malloc(SLAB_SIZE);
+    if (!slab) {
+        return false;
+    }
+    for (int offset = 0; offset + chunk <= SLAB_SIZE; offset += chunk) {
+        free_chunk * c = (free_chunk *)(slab + offset);
+        c->next = local.head;
+        local.head = c;
+        ++ local.count;
+    }
+    return true;
+}
+
+char * buffer_pool::alloc(int & size)
+{
+    if (size > MAX_CHUNK_SIZE) {
+        return NULL;
+    }
+    int cls = size_class(size);
+    chunk_list & local = local_free[cls];
+    if (!local.head && !refill(cls)) {
+        return NULL;
+    }
+    free_chunk * c = local.head;
+    local.head = c->next;
+    -- local.count;
+    size = MIN_CHUNK_SIZE << cls;
+    return (char *)c;
+}
+
+void buffer_pool::free(char * buf, int size)
+{
+    if (!buf) {
+        return;
+    }
+    int cls = size_class(size);
+    chunk_list & local = local_free[cls];
+    free_chunk * c = (free_chunk *)buf;
+    c->next = local.head;
+    local.head = c;
+    ++ local.count;
+    if (local.count <= CACHE_LIMIT) {
+        return;
+    }
+    // 本线程缓存满了，归还一半到全局链表
+    global_locker[cls].lock();
+    while (local.count > CACHE_LIMIT / 2) {
+        c = local.head;
+        local.head = c->next;
+        -- local.count;
+        c->next = global_free[cls].head;
+        global_free[cls].head = c;
+        ++ global_free[cls].count;
+    }
+    global_locker[cls].unlock();
+}
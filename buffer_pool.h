@@ -0,0 +1,22 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+
+// 连接读写缓冲区的内存池。缓冲区按2KB、4KB ... 64KB分成几个大小等级，
+// 每个等级从64KB的slab中切分，用完之后放回空闲链表复用，不还给系统。
+// 每个线程先在自己的缓存中分配和回收，缓存满了或者空了才加锁访问全局的空闲链表，
+// 因此工作线程分配、reactor线程回收的情况也不会每次都加锁。
+class buffer_pool {
+public:
+    static const int MIN_CHUNK_SIZE = 2048;
+    static const int CLASS_NUMBER = 6;
+    static const int MAX_CHUNK_SIZE = MIN_CHUNK_SIZE << (CLASS_NUMBER - 1); // 64KB
+
+    // 分配至少size字节的缓冲区，size被改为实际的大小，超过MAX_CHUNK_SIZE时返回NULL
+    static char * alloc(int & size);
+    // 回收alloc得到的缓冲区，size是alloc返回的实际大小
+    static void free(char * buf, int size);
+};
+
+#endif
@@ -0,0 +1,288 @@
+#include "config.h"
+#include "http_conn.h"
+#include "reactor.h"
+#include "file_cache.h"
+#include "buffer_pool.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <ctype.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sched.h>
+
+static const int MAX_TIMEOUT = 24 * 3600 * 1000; // 一天
+
+config::config() :
+port(0), reactors(0), reuseport(false), uring(false), inline_requests(false),
+backlog(LISTEN_BACKLOG), max_conns(MAX_FD), event_batch(MAX_EVENT_NUMBER),
+threads(8), queue_depth(10000), work_stealing(false),
+request_timeout(CONN_TIMEOUT), keepalive_timeout(KEEPALIVE_TIMEOUT), linger_timeout(LINGER_TIMEOUT), max_requests(0),
+buffer_limit(http_conn::m_buffer_limit), write_quantum(http_conn::m_write_quantum), send_lowat(http_conn::m_send_lowat),
+root(http_conn::m_root), cache_bytes(file_cache::MAX_CACHE_BYTES), cache_file_size(file_cache::MAX_MEMORY_FILE_SIZE),
+cache_entries(file_cache::MAX_ENTRIES), compression(file_cache::m_compression),
+compress_cache_bytes(file_cache::MAX_COMPRESSED_BYTES), log_level(logger::INFO)
+{
+}
+
+// 所有配置项，load、set和dump共用。范围只对INT和SIZE有意义
+std::vector<config::item> config::items()
+{
+    item table[] = {
+        { "port", INT, &port, 1, 65535 },
+        { "reactors", INT, &reactors, 0, 1024 },
+        { "reuseport", BOOL, &reuseport, 0, 0 },
+        { "uring", BOOL, &uring, 0, 0 },
+        { "inline", BOOL, &inline_requests, 0, 0 },
+        { "backlog", INT, &backlog, 1, 65535 },
+        // io_uring请求的user_data中连接下标只有24位
+        { "max_conns", INT, &max_conns, 1, (1 << 24) - 1 },
+        { "event_batch", INT, &event_batch, 1, 1 << 20 },
+        { "threads", INT, &threads, 1, 1024 },
+        { "queue_depth", INT, &queue_depth, 1, 1 << 24 },
+        { "work_stealing", BOOL, &work_stealing, 0, 0 },
+        { "cpus", CPUS, &cpus, 0, 0 },
+        { "request_timeout", INT, &request_timeout, 1, MAX_TIMEOUT },
+        { "keepalive_timeout", INT, &keepalive_timeout, 1, MAX_TIMEOUT },
+        { "linger_timeout", INT, &linger_timeout, 1, MAX_TIMEOUT },
+        { "max_requests", INT, &max_requests, 0, INT_MAX },
+        { "buffer_limit", SIZE, &buffer_limit, http_conn::READ_BUFFER_SIZE, buffer_pool::MAX_CHUNK_SIZE },
+        { "write_quantum", SIZE, &write_quantum, 4096, 1 << 30 },
+        { "send_lowat", SIZE, &send_lowat, 1, 1 << 30 },
+        { "root", STRING, &root, 0, 0 },
+        { "cache_bytes", SIZE, &cache_bytes, 0, 1LL << 40 },
+        { "cache_file_size", SIZE, &cache_file_size, 0, 1 << 30 },
+        { "cache_entries", INT, &cache_entries, 1, 1 << 20 },
+        { "compression", BOOL, &compression, 0, 0 },
+        { "compress_cache_bytes", SIZE, &compress_cache_bytes, 0, 1LL << 40 },
+        { "metrics_path", STRING, &metrics_path, 0, 0 },
+        { "log_level", LEVEL, &log_level, 0, 0 },
+        { "log_file", STRING, &log_file, 0, 0 },
+        { "access_log", STRING, &access_log, 0, 0 },
+    };
+    return std::vector<item>(table, table + sizeof(table) / sizeof(table[0]));
+}
+
+static bool parse_number(const char * value, bool suffix, long long & result)
+{
+    char * end;
+    errno = 0;
+    result = strtoll(value, &end, 10);
+    if (end == value || errno == ERANGE) {
+        return false;
+    }
+    if (suffix && *end) {
+        int shift = 0;
+        switch (tolower(*end)) {
+            case 'k': shift = 10; break;
+            case 'm': shift = 20; break;
+            case 'g': shift = 30; break;
+            default: return false;
+        }
+        if (result > (LLONG_MAX >> shift) || result < (LLONG_MIN >> shift)) {
+            return false;
+        }
+        result <<= shift;
+        ++ end;
+    }
+    return *end == '\0';
+}
+
+bool config::set(const char * key, const char * value)
+{
+    std::vector<item> all = items();
+    for (size_t i = 0; i < all.size(); ++ i) {
+        const item & it = all[i];
+        if (strcmp(it.name, key) != 0) {
+            continue;
+        }
+        long long number;
+        switch (it.type) {
+            case INT:
+            case SIZE:
+                if (!parse_number(value, it.type == SIZE, number) || number < it.min || number > it.max) {
+                    LOG_ERROR("invalid %s: %s, must be in [%lld, %lld]", key, value, it.min, it.max);
+                    return false;
+                }
+                if (it.type == INT) {
+                    *(int *)it.value = (int)number;
+                } else {
+                    *(long long *)it.value = number;
+                }
+                return true;
+            case BOOL:
+                if (!strcasecmp(value, "on") || !strcasecmp(value, "yes") || !strcasecmp(value, "true") || !strcmp(value, "1")) {
+                    *(bool *)it.value = true;
+                } else if (!strcasecmp(value, "off") || !strcasecmp(value, "no") || !strcasecmp(value, "false") || !strcmp(value, "0")) {
+                    *(bool *)it.value = false;
+                } else {
+                    LOG_ERROR("invalid %s: %s, must be on or off", key, value);
+                    return false;
+                }
+                return true;
+            case STRING:
+                *(std::string *)it.value = value;
+                return true;
+            case CPUS: {
+                std::vector<int> list;
+                std::string copy(value);
+                for (char * cpu = strtok(&copy[0], ", "); cpu; cpu = strtok(NULL, ", ")) {
+                    if (!parse_number(cpu, false, number) || number < 0 || number >= CPU_SETSIZE) {
+                        LOG_ERROR("invalid %s: %s", key, value);
+                        return false;
+                    }
+                    list.push_back((int)number);
+                }
+                ((std::vector<int> *)it.value)->swap(list);
+                return true;
+            }
+            case LEVEL:
+                number = logger::parse_level(value);
+                if (number < 0) {
+                    LOG_ERROR("invalid %s: %s, must be debug, info, warn, error or off", key, value);
+                    return false;
+                }
+                *(int *)it.value = (int)number;
+                return true;
+        }
+    }
+    LOG_ERROR("unknown config item: %s", key);
+    return false;
+}
+
+// 去掉首尾的空白字符
+static char * trim(char * s)
+{
+    while (isspace((unsigned char)*s)) {
+        ++ s;
+    }
+    char * end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) {
+        -- end;
+    }
+    *end = '\0';
+    return s;
+}
+
+bool config::load(const char * path)
+{
+    FILE * fp = fopen(path, "r");
+    if (!fp) {
+        LOG_ERROR("open config file %s failed, errno is: %d", path, errno);
+        return false;
+    }
+    char line[4096];
+    int lineno = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fp)) {
+        ++ lineno;
+        char * text = trim(line);
+        if (*text == '\0' || *text == '#') {
+            continue;
+        }
+        char * eq = strchr(text, '=');
+        if (!eq) {
+            LOG_ERROR("%s:%d: expected key = value", path, lineno);
+            ok = false;
+            break;
+        }
+        *eq = '\0';
+        if (!set(trim(text), trim(eq + 1))) {
+            LOG_ERROR("%s:%d: invalid config item", path, lineno);
+            ok = false;
+        }
+    }
+    fclose(fp);
+    return ok;
+}
+
+bool config::check()
+{
+    if (port == 0) {
+        LOG_ERROR("port is not specified");
+        return false;
+    }
+    if (reuseport && reactors == 0) {
+        LOG_ERROR("reuseport needs at least one sub reactor");
+        return false;
+    }
+    if (!metrics_path.empty() && metrics_path[0] != '/') {
+        LOG_ERROR("metrics_path must start with /");
+        return false;
+    }
+    if (root.empty() || root.size() >= http_conn::FILENAME_LEN) {
+        LOG_ERROR("invalid root: %s", root.c_str());
+        return false;
+    }
+    struct stat st;
+    if (stat(root.c_str(), &st) < 0 || !S_ISDIR(st.st_mode)) {
+        // 目录可能稍后才创建，不作为错误
+        LOG_WARN("root %s is not a directory", root.c_str());
+    }
+    return true;
+}
+
+std::string config::format(const item & it)
+{
+    char buf[32];
+    switch (it.type) {
+        case INT:
+            snprintf(buf, sizeof(buf), "%d", *(int *)it.value);
+            return buf;
+        case SIZE:
+            snprintf(buf, sizeof(buf), "%lld", *(long long *)it.value);
+            return buf;
+        case BOOL:
+            return *(bool *)it.value ? "on" : "off";
+        case STRING:
+            return ((std::string *)it.value)->empty() ? "-" : *(std::string *)it.value;
+        case CPUS: {
+            const std::vector<int> & list = *(std::vector<int> *)it.value;
+            if (list.empty()) {
+                return "-";
+            }
+            std::string s;
+            for (size_t i = 0; i < list.size(); ++ i) {
+                snprintf(buf, sizeof(buf), i ? ",%d" : "%d", list[i]);
+                s += buf;
+            }
+            return s;
+        }
+        case LEVEL: {
+            static const char * names[] = { "debug", "info", "warn", "error", "off" };
+            return names[*(int *)it.value];
+        }
+    }
+    return "";
+}
+
+void config::dump()
+{
+    std::vector<item> all = items();
+    for (size_t i = 0; i < all.size(); ++ i) {
+        LOG_INFO("config %-18s %s", all[i].name, format(all[i]).c_str());
+    }
+}
+
+void config::apply()
+{
+    http_conn::m_root = root.c_str();
+    http_conn::m_buffer_limit = (int)buffer_limit;
+    http_conn::m_request_timeout = request_timeout;
+    http_conn::m_keepalive_timeout = keepalive_timeout;
+    http_conn::m_linger_timeout = linger_timeout;
+    http_conn::m_max_requests = max_requests;
+    http_conn::m_write_quantum = (int)write_quantum;
+    http_conn::m_send_lowat = (int)send_lowat;
+    http_conn::m_metrics_path = metrics_path.empty() ? NULL : metrics_path.c_str();
+    reactor::m_max_conns = max_conns;
+    reactor::m_max_events = event_batch;
+    file_cache::m_max_bytes = cache_bytes;
+    file_cache::m_max_file_size = cache_file_size;
+    file_cache::m_max_entries = cache_entries;
+    file_cache::m_compression = compression;
+    file_cache::m_max_compressed_bytes = compress_cache_bytes;
+}
@@ -0,0 +1,76 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <string>
+#include <vector>
+
+// 服务器的运行时配置。默认值和原来编译时的常量一致，可以用配置文件(-f)覆盖，
+// 命令行上的选项再覆盖配置文件。配置文件每行一项 key = value，#开始的行和空行忽略，
+// 项的名字和命令行的 -o key=value 相同，完整的列表见仓库中的webserver.conf。
+// 大小可以带k/m/g后缀(1024进制)，时间的单位是毫秒。
+class config {
+public:
+    config();
+
+    bool load(const char * path); // 读取配置文件，出错时打印文件名和行号并返回false
+    bool set(const char * key, const char * value); // 设置一项，key不存在或value不合法时返回false
+    bool check(); // 各项之间的约束，比如分片监听模式需要子reactor
+    void dump(); // 启动时把生效的配置逐项写入运行日志
+    void apply(); // 写入http_conn、reactor、file_cache的静态成员，本对象需要在服务器运行期间一直有效
+
+    // 网络
+    int port; // 0表示没有指定
+    int reactors;
+    bool reuseport;
+    bool uring;
+    bool inline_requests;
+    int backlog;
+    int max_conns;
+    int event_batch;
+    // 线程池
+    int threads;
+    int queue_depth;
+    bool work_stealing;
+    std::vector<int> cpus;
+    // 连接
+    int request_timeout;
+    int keepalive_timeout;
+    int linger_timeout;
+    int max_requests;
+    long long buffer_limit;
+    long long write_quantum;
+    long long send_lowat;
+    // 静态文件
+    std::string root;
+    long long cache_bytes;
+    long long cache_file_size;
+    int cache_entries;
+    bool compression;
+    long long compress_cache_bytes;
+    // 统计信息和日志
+    std::string metrics_path;
+    int log_level;
+    std::string log_file;
+    std::string access_log;
+
+private:
+    enum TYPE {
+        INT = 0,    // int，范围[min, max]
+        SIZE,       // long long，可以带k/m/g后缀
+        BOOL,       // on/off、yes/no、true/false、1/0
+        STRING,
+        CPUS,       // 逗号分隔的CPU编号
+        LEVEL       // 日志级别
+    };
+    struct item {
+        const char * name;
+        TYPE type;
+        void * value;
+        long long min;
+        long long max;
+    };
+    std::vector<item> items();
+    std::string format(const item & it);
+};
+
+#endif
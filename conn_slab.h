@@ -0,0 +1,74 @@
+#ifndef CONN_SLAB_H
+#define CONN_SLAB_H
+
+#include <stdint.h>
+#include <vector>
+#include "http_conn.h"
+
+// 连接对象池，每个reactor一个，只在所属reactor线程中使用，不需要加锁。
+// 连接对象按块(CHUNK_SIZE个)向系统申请，块不会移动也不会释放，关闭的连接放回空闲链表，
+// 下一个新连接优先复用最近释放的槽，占用的内存随同时存在的连接数量增长，而不是按MAX_FD预先分配。
+// 每个槽有一个代数，槽被释放时加1。注册到epoll中的数据是句柄：高32位是代数，低32位是槽的下标，
+// 连接关闭之后还没处理的事件带着旧的代数，get()返回NULL，不会作用到复用了同一个槽或fd的新连接上。
+class conn_slab {
+public:
+    static const int CHUNK_SIZE = 256;
+
+    conn_slab() {}
+    ~conn_slab() {
+        for (size_t i = 0; i < m_chunks.size(); ++ i) {
+            delete [] m_chunks[i];
+        }
+    }
+
+    // 取一个空闲的槽，空闲链表为空时申请一个新的块
+    http_conn * alloc() {
+        if (m_free.empty()) {
+            uint32_t base = m_chunks.size() * CHUNK_SIZE;
+            http_conn * chunk = new http_conn[CHUNK_SIZE];
+            m_chunks.push_back(chunk);
+            m_free.reserve(m_chunks.size() * CHUNK_SIZE); // 之后归还槽时不需要再扩容
+            for (int i = CHUNK_SIZE - 1; i >= 0; -- i) {
+                chunk[i].m_handle = make_handle(1, base + i);
+                m_free.push_back(base + i);
+            }
+        }
+        uint32_t index = m_free.back();
+        m_free.pop_back();
+        return slot(index);
+    }
+
+    // 归还连接关闭后的槽，代数加1使旧的句柄失效
+    void free(http_conn * conn) {
+        uint32_t index = (uint32_t)conn->m_handle;
+        uint32_t generation = (uint32_t)(conn->m_handle >> 32) + 1;
+        conn->m_handle = make_handle(generation ? generation : 1, index); // 代数为0的句柄表示普通fd
+        m_free.push_back(index);
+    }
+
+    // 由epoll事件中的句柄找到连接，槽已经被释放或者复用时返回NULL
+    http_conn * get(uint64_t handle) {
+        uint32_t index = (uint32_t)handle;
+        if (index >= m_chunks.size() * CHUNK_SIZE) {
+            return NULL;
+        }
+        http_conn * conn = slot(index);
+        return conn->m_handle == handle && conn->getfd() != -1 ? conn : NULL;
+    }
+
+    // 句柄的高32位不为0，epoll中注册的其他fd(监听socket、eventfd、timerfd等)直接以fd作为数据，高32位为0
+    static bool is_handle(uint64_t data) {return (data >> 32) != 0;}
+
+private:
+    static uint64_t make_handle(uint32_t generation, uint32_t index) {
+        return ((uint64_t)generation << 32) | index;
+    }
+    http_conn * slot(uint32_t index) {
+        return m_chunks[index / CHUNK_SIZE] + index % CHUNK_SIZE;
+    }
+
+    std::vector<http_conn *> m_chunks;
+    std::vector<uint32_t> m_free; // 空闲槽的下标，作为栈使用
+};
+
+#endif
@@ -0,0 +1,658 @@
+#include "file_cache.h"
+#include "logger.h"
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+static const int GZIP_LEVEL = 9;        // 每个文件只压缩一次，结果被缓存，用最高的压缩级别
+#ifdef HAVE_BROTLI
+static const int BROTLI_QUALITY = 9;    // 11比9只小几个百分点，但是慢十倍以上
+#endif
+
+size_t file_cache::m_max_bytes = MAX_CACHE_BYTES;
+size_t file_cache::m_max_file_size = MAX_MEMORY_FILE_SIZE;
+size_t file_cache::m_max_entries = MAX_ENTRIES;
+size_t file_cache::m_max_compressed_bytes = MAX_COMPRESSED_BYTES;
+bool file_cache::m_compression = true;
+
+// 按优先顺序排列的编码，以及对应的预压缩文件后缀和Content-Encoding
+static const struct {
+    int encoding;
+    const char * suffix;
+    const char * name;
+} encodings_table[] = {
+    { file_cache::BROTLI, ".br", "br" },
+    { file_cache::GZIP, ".gz", "gzip" },
+};
+static const int ENCODING_NUMBER = sizeof(encodings_table) / sizeof(encodings_table[0]);
+
+// 后台线程能够生成的编码
+#ifdef HAVE_BROTLI
+static const int COMPRESSIBLE_ENCODINGS = file_cache::GZIP | file_cache::BROTLI;
+#else
+static const int COMPRESSIBLE_ENCODINGS = file_cache::GZIP;
+#endif
+
+// 按扩展名决定的Content-Type，text表示值得压缩的文本类型
+static const struct mime_type {
+    const char * extension;
+    const char * type;
+    bool text;
+} mime_types[] = {
+    { ".html", "text/html", true },
+    { ".htm", "text/html", true },
+    { ".css", "text/css", true },
+    { ".js", "text/javascript", true },
+    { ".mjs", "text/javascript", true },
+    { ".json", "application/json", true },
+    { ".xml", "application/xml", true },
+    { ".svg", "image/svg+xml", true },
+    { ".txt", "text/plain", true },
+    { ".csv", "text/csv", true },
+    { ".md", "text/markdown", true },
+    { ".png", "image/png", false },
+    { ".jpg", "image/jpeg", false },
+    { ".jpeg", "image/jpeg", false },
+    { ".gif", "image/gif", false },
+    { ".webp", "image/webp", false },
+    { ".ico", "image/x-icon", false },
+    { ".woff2", "font/woff2", false },
+    { ".pdf", "application/pdf", false },
+};
+static const char * DEFAULT_TYPE = "text/html"; // 不认识的扩展名，和原来所有文件都用text/html保持一致
+
+// 按path的前len个字符的扩展名查找类型，预压缩文件传入去掉.br/.gz之后的长度，找不到时返回NULL
+static const mime_type * find_type(const char * path, size_t len)
+{
+    const char * dot = NULL;
+    for (size_t i = len; i > 0 && path[i - 1] != '/'; -- i) {
+        if (path[i - 1] == '.') {
+            dot = path + i - 1;
+            break;
+        }
+    }
+    if (!dot) {
+        return NULL;
+    }
+    for (size_t i = 0; i < sizeof(mime_types) / sizeof(mime_types[0]); ++ i) {
+        size_t n = strlen(mime_types[i].extension);
+        if ((size_t)(path + len - dot) == n && strncasecmp(dot, mime_types[i].extension, n) == 0) {
+            return &mime_types[i];
+        }
+    }
+    return NULL;
+}
+
+// 与add_status_line、add_content_length和add_content_type生成的内容保持一致。
+// 可能发送压缩内容的文件都带上Vary，避免中间的缓存把压缩的响应发给不支持的客户端
+static std::string make_header(long long size, const mime_type * type, const char * encoding, bool vary)
+{
+    char header[256];
+    int len = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Length: %lld\r\nContent-Type:%s\r\n%s%s%s%s",
+        size, type ? type->type : DEFAULT_TYPE, encoding ? "Content-Encoding: " : "", encoding ? encoding : "",
+        encoding ? "\r\n" : "", vary ? "Vary: Accept-Encoding\r\n" : "");
+    return std::string(header, len);
+}
+
+file_cache & file_cache::get_instance()
+{
+    static file_cache instance;
+    return instance;
+}
+
+file_cache::file_cache() : m_bytes(0), m_inotifyfd(-1), m_generation(0), m_compressed_bytes(0),
+m_compressor_running(false), m_stop(false)
+{
+    if (m_compression) {
+        m_compressor_running = pthread_create(&m_compressor, NULL, compressor, (void *)this) == 0;
+    }
+    m_inotifyfd = inotify_init1(IN_CLOEXEC);
+    if (m_inotifyfd < 0) {
+        LOG_WARN("inotify unavailable, file cache falls back to mtime checks");
+        return;
+    }
+    if (pthread_create(&m_watcher, NULL, watcher, (void *)this) != 0) {
+        close(m_inotifyfd);
+        m_inotifyfd = -1;
+    }
+}
+
+file_cache::~file_cache()
+{
+    if (m_compressor_running) {
+        m_locker.lock();
+        m_stop = true;
+        m_locker.unlock();
+        m_jobstat.post();
+        pthread_join(m_compressor, NULL);
+    }
+    if (m_inotifyfd != -1) {
+        pthread_cancel(m_watcher);
+        pthread_join(m_watcher, NULL);
+        close(m_inotifyfd);
+        m_inotifyfd = -1;
+    }
+    m_locker.lock();
+    for (size_t i = 0; i < m_jobs.size(); ++ i) {
+        put(m_jobs[i].source);
+    }
+    m_jobs.clear();
+    while (!m_lru.empty()) {
+        unlink_entry(m_lru.back());
+    }
+    while (!m_compressed_lru.empty()) {
+        unlink_entry(m_compressed_lru.back());
+    }
+    m_locker.unlock();
+}
+
+file_cache::entry * file_cache::acquire(const char * path, int & err, int encodings)
+{
+    entry * e = acquire_file(path, path, IDENTITY, err);
+    return e ? negotiate(e, encodings, false) : NULL;
+}
+
+file_cache::entry * file_cache::lookup(const char * path, int encodings)
+{
+    entry * e = lookup_file(path);
+    return e ? negotiate(e, encodings, true) : NULL;
+}
+
+file_cache::entry * file_cache::acquire_file(const std::string & key, const char * path, int encoding, int & err)
+{
+    m_locker.lock();
+    std::unordered_map<std::string, lru_list::iterator>::iterator it = m_table.find(key);
+    if (it == m_table.end()) {
+        m_locker.unlock();
+    } else {
+        entry * e = *(it->second);
+        time_t cur = time(NULL);
+        // 命中，移到LRU链表的头部
+        m_lru.splice(m_lru.begin(), m_lru, it->second);
+        e->refcount ++;
+        if (e->wd >= 0 || cur - e->checked < REVALIDATE_INTERVAL) {
+            m_locker.unlock();
+            return e;
+        }
+        m_locker.unlock();
+        // 没有inotify监视的缓存项，定期用mtime确认文件没有变化。stat在慢的文件系统上可能阻塞，
+        // 不能持有锁，期间缓存项由上面的引用保证不被释放
+        struct stat st;
+        bool valid = stat(path, &st) == 0 && st.st_mtime == e->st.st_mtime &&
+            st.st_size == e->st.st_size && st.st_ino == e->st.st_ino;
+        m_locker.lock();
+        if (valid) {
+            e->checked = cur;
+        } else {
+            unlink_entry(e); // 已经被其他线程移出缓存时什么都不做
+        }
+        m_locker.unlock();
+        if (valid) {
+            return e;
+        }
+        put(e);
+    }
+
+    unsigned long generation = m_generation;
+    entry * e = load(path, encoding, err);
+    if (!e) {
+        return NULL;
+    }
+    e->key = key;
+
+    m_locker.lock();
+    if (generation == m_generation) {
+        it = m_table.find(key);
+        if (it != m_table.end()) {
+            // 其他线程同时加载了同一个文件，用新加载的替换
+            unlink_entry(*(it->second));
+        }
+        e->cached = true;
+        e->refcount ++; // 缓存表持有的引用
+        m_lru.push_front(e);
+        m_table[key] = m_lru.begin();
+        if (e->fd == -1) {
+            m_bytes += e->st.st_size;
+        }
+        evict();
+    } else {
+        // 加载期间文件可能被修改，不放入缓存，也不再需要监视
+        unwatch(e->wd);
+        e->wd = -1;
+    }
+    m_locker.unlock();
+    return e;
+}
+
+file_cache::entry * file_cache::lookup_file(const std::string & key)
+{
+    m_locker.lock();
+    std::unordered_map<std::string, lru_list::iterator>::iterator it = m_table.find(key);
+    if (it == m_table.end()) {
+        m_locker.unlock();
+        return NULL;
+    }
+    entry * e = *(it->second);
+    if (!e->data || (e->wd < 0 && time(NULL) - e->checked >= REVALIDATE_INTERVAL)) {
+        m_locker.unlock();
+        return NULL;
+    }
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+    e->refcount ++;
+    m_locker.unlock();
+    return e;
+}
+
+file_cache::entry * file_cache::negotiate(entry * e, int encodings, bool cache_only)
+{
+    if (!m_compression || !encodings) {
+        return e;
+    }
+    // 预压缩文件，不需要任何CPU开销，大文件也可以用sendfile发送
+    for (int i = 0; i < ENCODING_NUMBER; ++ i) {
+        int encoding = encodings_table[i].encoding;
+        if (!(encodings & e->precompressed & encoding)) {
+            continue;
+        }
+        std::string key = e->path + "\n" + encodings_table[i].name;
+        entry * v;
+        if (cache_only) {
+            v = lookup_file(key);
+        } else {
+            int err;
+            std::string path = e->path + encodings_table[i].suffix;
+            v = acquire_file(key, path.c_str(), encoding, err);
+            if (!v) {
+                e->precompressed &= ~encoding; // 预压缩文件已经被删除，之后不再尝试
+                continue;
+            }
+        }
+        put(e);
+        return v; // cache_only时不在内存中，交给工作线程
+    }
+
+    // 压缩结果，只尝试最优先的一种编码，还没有压缩时交给后台线程，这次先发送原文件
+    int candidates = encodings & COMPRESSIBLE_ENCODINGS & ~e->incompressible;
+    if (!e->compressible || !candidates || !m_compressor_running) {
+        return e;
+    }
+    int i = 0;
+    while (!(encodings_table[i].encoding & candidates)) {
+        ++ i;
+    }
+    char key[64];
+    snprintf(key, sizeof(key), "\n%ld.%09ld\n%lld\n%lu\n%s", (long)e->st.st_mtim.tv_sec, (long)e->st.st_mtim.tv_nsec,
+        (long long)e->st.st_size, (unsigned long)e->st.st_ino, encodings_table[i].name);
+    std::string full_key = e->path + key;
+    m_locker.lock();
+    std::unordered_map<std::string, lru_list::iterator>::iterator it = m_compressed.find(full_key);
+    if (it != m_compressed.end()) {
+        entry * v = *(it->second);
+        m_compressed_lru.splice(m_compressed_lru.begin(), m_compressed_lru, it->second);
+        v->refcount ++;
+        m_locker.unlock();
+        put(e);
+        return v;
+    }
+    if (m_jobs.size() < MAX_COMPRESS_JOBS && m_pending.insert(full_key).second) {
+        compress_job job;
+        job.source = e;
+        job.encoding = encodings_table[i].encoding;
+        job.key = full_key;
+        e->refcount ++; // 压缩线程持有的引用
+        m_jobs.push_back(job);
+        m_jobstat.post();
+    }
+    m_locker.unlock();
+    return e;
+}
+
+void file_cache::release(entry * e)
+{
+    if (e) {
+        put(e);
+    }
+}
+
+file_cache::entry * file_cache::load(const char * path, int encoding, int & err)
+{
+    struct stat st;
+    if (stat(path, &st) < 0) {
+        err = errno;
+        return NULL;
+    }
+    // 判断访问权限
+    if (!(st.st_mode & S_IROTH)) {
+        err = EACCES;
+        return NULL;
+    }
+    // 判断是否是目录
+    if (S_ISDIR(st.st_mode)) {
+        err = EISDIR;
+        return NULL;
+    }
+
+    // 先建立监视再读取文件，读取之后发生的修改一定能收到事件。
+    // 在锁内建立监视并计数：同一个inode已经有监视时内核返回同一个wd，不能让其他线程在这之间把它删除
+    int wd = -1;
+    if (m_inotifyfd != -1) {
+        m_locker.lock();
+        wd = inotify_add_watch(m_inotifyfd, path,
+            IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF);
+        if (wd >= 0) {
+            m_watches[wd] ++;
+        }
+        m_locker.unlock();
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        err = errno;
+        if (fd >= 0) {
+            close(fd);
+        }
+        m_locker.lock();
+        unwatch(wd);
+        m_locker.unlock();
+        return NULL;
+    }
+
+    char * data = NULL;
+    if ((size_t)st.st_size <= m_max_file_size) {
+        // 小文件直接读入内存，之后的响应可以和响应头一起用一次writev发出
+        data = (char *)malloc(st.st_size > 0 ? st.st_size : 1);
+        off_t done = 0;
+        while (data && done < st.st_size) {
+            ssize_t n = pread(fd, data + done, st.st_size - done, done);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                free(data);
+                data = NULL;
+            } else {
+                done += n;
+            }
+        }
+        close(fd);
+        fd = -1;
+        if (!data) {
+            err = EIO;
+            m_locker.lock();
+            unwatch(wd);
+            m_locker.unlock();
+            return NULL;
+        }
+    }
+
+    entry * e = new entry;
+    e->path = path;
+    e->key = path;
+    e->st = st;
+    e->fd = fd;
+    e->data = data;
+    e->wd = wd;
+    e->checked = time(NULL);
+    e->refcount = 1; // 调用者持有的引用
+    e->cached = false;
+    e->encoding = encoding;
+    e->generated = false;
+    e->compressible = false;
+    e->precompressed = 0;
+    e->incompressible = 0;
+
+    const char * name = NULL;
+    size_t type_len = strlen(path);
+    for (int i = 0; i < ENCODING_NUMBER; ++ i) {
+        if (encodings_table[i].encoding == encoding) {
+            // 预压缩文件的类型由原文件的扩展名决定，如 style.css.gz 是 text/css
+            name = encodings_table[i].name;
+            type_len -= strlen(encodings_table[i].suffix);
+        }
+    }
+    const mime_type * type = find_type(path, type_len);
+    bool text = m_compression && encoding == IDENTITY && type && type->text;
+    if (text) {
+        e->compressible = data && (size_t)st.st_size >= MIN_COMPRESS_SIZE;
+        // 只使用不比原文件旧的预压缩文件，原文件修改之后没有重新生成的预压缩文件内容已经过期
+        std::string sibling(path);
+        for (int i = 0; i < ENCODING_NUMBER; ++ i) {
+            struct stat sst;
+            sibling.resize(strlen(path));
+            sibling += encodings_table[i].suffix;
+            if (stat(sibling.c_str(), &sst) == 0 && S_ISREG(sst.st_mode) && (sst.st_mode & S_IROTH) &&
+                sst.st_mtime >= st.st_mtime) {
+                e->precompressed |= encodings_table[i].encoding;
+            }
+        }
+    }
+    e->header = make_header(st.st_size, type, name, text || encoding != IDENTITY);
+    return e;
+}
+
+void file_cache::unlink_entry(entry * e)
+{
+    if (!e->cached) {
+        return;
+    }
+    if (e->generated) {
+        std::unordered_map<std::string, lru_list::iterator>::iterator it = m_compressed.find(e->key);
+        m_compressed_lru.erase(it->second);
+        m_compressed.erase(it);
+        m_compressed_bytes -= e->st.st_size;
+    } else {
+        std::unordered_map<std::string, lru_list::iterator>::iterator it = m_table.find(e->key);
+        m_lru.erase(it->second);
+        m_table.erase(it);
+        if (e->fd == -1) {
+            m_bytes -= e->st.st_size;
+        }
+        unwatch(e->wd);
+        e->wd = -1;
+    }
+    e->cached = false;
+    put(e);
+}
+
+void file_cache::unwatch(int wd)
+{
+    if (wd < 0) {
+        return;
+    }
+    std::unordered_map<int, int>::iterator it = m_watches.find(wd);
+    if (it == m_watches.end() || -- it->second > 0) {
+        return;
+    }
+    m_watches.erase(it);
+    // 文件被删除时内核已经自动删除了监视，这里返回EINVAL，可以忽略
+    inotify_rm_watch(m_inotifyfd, wd);
+}
+
+void file_cache::evict()
+{
+    while (!m_lru.empty() && (m_table.size() > m_max_entries || m_bytes > m_max_bytes)) {
+        unlink_entry(m_lru.back());
+    }
+    while (!m_compressed_lru.empty() && m_compressed_bytes > m_max_compressed_bytes) {
+        unlink_entry(m_compressed_lru.back());
+    }
+}
+
+void file_cache::put(entry * e)
+{
+    if (-- e->refcount == 0) {
+        if (e->fd != -1) {
+            close(e->fd);
+        }
+        free(e->data);
+        delete e;
+    }
+}
+
+void * file_cache::watcher(void * arg)
+{
+    file_cache * cache = (file_cache *)arg;
+    cache->watch();
+    return cache;
+}
+
+void file_cache::watch()
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true) {
+        ssize_t len = read(m_inotifyfd, buf, sizeof(buf)); // 阻塞读取，析构时通过pthread_cancel退出
+        if (len <= 0) {
+            if (len < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        int oldstate;
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
+        m_locker.lock();
+        m_generation ++;
+        for (char * ptr = buf; ptr < buf + len; ) {
+            struct inotify_event * event = (struct inotify_event *)ptr;
+            // 同一个inode的不同路径共用一个watch，所有使用该watch的缓存项都要失效。
+            // 压缩结果的key中包含原文件的mtime，原文件修改之后自然不会再命中，由LRU淘汰
+            for (lru_list::iterator it = m_lru.begin(); it != m_lru.end(); ) {
+                entry * e = *it;
+                ++ it;
+                if (e->wd == event->wd) {
+                    unlink_entry(e);
+                }
+            }
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+        m_locker.unlock();
+        pthread_setcancelstate(oldstate, NULL);
+    }
+}
+
+void * file_cache::compressor(void * arg)
+{
+    file_cache * cache = (file_cache *)arg;
+    cache->compress_jobs();
+    return cache;
+}
+
+void file_cache::compress_jobs()
+{
+    while (true) {
+        m_jobstat.wait();
+        m_locker.lock();
+        if (m_stop) {
+            m_locker.unlock();
+            break;
+        }
+        if (m_jobs.empty()) {
+            m_locker.unlock();
+            continue;
+        }
+        compress_job job = m_jobs.front();
+        m_jobs.pop_front();
+        m_locker.unlock();
+
+        // 原文件的内容在持有引用期间不会改变，压缩不需要持有锁
+        entry * v = compress(job.source, job.encoding);
+
+        m_locker.lock();
+        m_pending.erase(job.key);
+        if (!v) {
+            job.source->incompressible |= job.encoding;
+        } else if (!job.source->cached) {
+            put(v); // 压缩期间原文件已经失效
+        } else {
+            v->key = job.key;
+            v->cached = true;
+            m_compressed_lru.push_front(v);
+            m_compressed[job.key] = m_compressed_lru.begin();
+            m_compressed_bytes += v->st.st_size;
+            evict();
+        }
+        put(job.source);
+        m_locker.unlock();
+    }
+}
+
+file_cache::entry * file_cache::compress(entry * source, int encoding)
+{
+    size_t size = source->st.st_size;
+    size_t bound;
+    char * out = NULL;
+    size_t len = 0;
+    if (encoding == GZIP) {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        // windowBits加16输出gzip格式
+        if (deflateInit2(&zs, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return NULL;
+        }
+        bound = deflateBound(&zs, size);
+        out = (char *)malloc(bound);
+        zs.next_in = (Bytef *)source->data;
+        zs.avail_in = size;
+        zs.next_out = (Bytef *)out;
+        zs.avail_out = bound;
+        int ret = out ? deflate(&zs, Z_FINISH) : Z_MEM_ERROR;
+        len = zs.total_out;
+        deflateEnd(&zs);
+        if (ret != Z_STREAM_END) {
+            free(out);
+            return NULL;
+        }
+    }
+#ifdef HAVE_BROTLI
+    else if (encoding == BROTLI) {
+        bound = BrotliEncoderMaxCompressedSize(size);
+        out = (char *)malloc(bound ? bound : 1);
+        len = bound;
+        if (!out || !BrotliEncoderCompress(BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                size, (const uint8_t *)source->data, &len, (uint8_t *)out)) {
+            free(out);
+            return NULL;
+        }
+    }
+#endif
+    else {
+        return NULL;
+    }
+    if (len >= size) {
+        free(out);
+        return NULL;
+    }
+
+    const char * name = NULL;
+    for (int i = 0; i < ENCODING_NUMBER; ++ i) {
+        if (encodings_table[i].encoding == encoding) {
+            name = encodings_table[i].name;
+        }
+    }
+    entry * e = new entry;
+    e->path = source->path;
+    e->st = source->st;
+    e->st.st_size = len;
+    e->fd = -1;
+    e->data = out;
+    e->header = make_header(len, find_type(source->path.c_str(), source->path.size()), name, true);
+    e->wd = -1;
+    e->checked = source->checked;
+    e->refcount = 1; // 压缩结果缓存表持有的引用
+    e->cached = false;
+    e->encoding = encoding;
+    e->generated = true;
+    e->compressible = false;
+    e->precompressed = 0;
+    e->incompressible = 0;
+    return e;
+}
@@ -0,0 +1,128 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/stat.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <deque>
+#include "locker.h"
+
+// 静态文件缓存，所有连接共享，以请求文件的完整路径为key。
+// 每个缓存项保存文件的stat信息、预先生成好的响应头以及文件内容：小文件直接读入内存，
+// 大文件保持一个打开的fd供sendfile使用。命中时不需要任何文件系统相关的系统调用，
+// 文件被修改、删除或移动时由inotify线程使缓存项失效(inotify不可用时退化为定期检查mtime)。
+// 缓存项使用引用计数，被淘汰或失效的缓存项要等所有正在发送它的连接释放后才真正销毁。
+// 压缩：获取缓存项时传入客户端接受的编码(Accept-Encoding)，文本类型的文件优先使用同目录下
+// 不比原文件旧的预压缩文件(.br、.gz)；没有预压缩文件时，第一次请求交给后台线程压缩，本次先发送原文件，
+// 压缩结果按 路径+mtime+编码 保存在单独的、有总大小上限的LRU缓存中，之后的请求直接使用。
+class file_cache {
+public:
+    static const size_t MAX_CACHE_BYTES = 64 * 1024 * 1024; // 缓存在内存中的文件内容总大小上限
+    static const size_t MAX_MEMORY_FILE_SIZE = 256 * 1024;  // 不超过该大小的文件内容直接读入内存
+    static const size_t MAX_ENTRIES = 1024;                 // 缓存项数量上限，同时也限制了缓存占用的fd数量
+    static const int REVALIDATE_INTERVAL = 1;               // 没有inotify时，缓存项每隔多少秒检查一次mtime
+    static const size_t MAX_COMPRESSED_BYTES = 16 * 1024 * 1024; // 压缩结果的总大小上限
+    static const size_t MIN_COMPRESS_SIZE = 256;            // 更小的文件压缩之后节省不了几个字节，不压缩
+    static const size_t MAX_COMPRESS_JOBS = 64;             // 等待压缩的文件数量上限，超过时本次不压缩
+
+    // 响应体的编码，同时用作客户端接受的编码的位掩码
+    enum encoding {
+        IDENTITY = 0,
+        GZIP = 1,
+        BROTLI = 2
+    };
+
+    // 运行时的上限，默认为上面的常量，需要在第一次使用缓存之前设置
+    static size_t m_max_bytes;
+    static size_t m_max_file_size;
+    static size_t m_max_entries;
+    static size_t m_max_compressed_bytes; // 默认为MAX_COMPRESSED_BYTES
+    static bool m_compression; // 是否发送压缩的响应，默认开启
+
+    struct entry {
+        std::string path;
+        std::string key;            // 在缓存表中的key：原文件是路径，预压缩文件是原文件的路径加上编码，压缩结果还包括mtime
+        struct stat st;             // 文件的状态信息，压缩结果的st_size是压缩之后的长度
+        int fd;                     // 大文件的fd，sendfile使用显式偏移，多个连接可以同时使用；小文件为-1
+        char * data;                // 小文件的内容，大文件为NULL
+        std::string header;         // 预先生成的状态行、Content-Length、Content-Type以及Content-Encoding
+        int wd;                     // inotify的watch描述符
+        time_t checked;             // 上次确认文件没有变化的时间
+        std::atomic<int> refcount;  // 缓存表本身也持有一个引用
+        bool cached;                // 是否仍在缓存表中
+        int encoding;               // 响应体的编码
+        bool generated;             // 后台线程压缩生成的缓存项，在压缩结果的缓存表中
+        // 以下只用于原文件的缓存项
+        bool compressible;          // 文本类型并且内容在内存中，可以由后台线程压缩
+        std::atomic<int> precompressed;     // 存在并且不比原文件旧的预压缩文件的编码
+        std::atomic<int> incompressible;    // 压缩之后没有变小的编码，不再尝试
+    };
+
+    static file_cache & get_instance();
+
+    // 获取path对应的缓存项，失败时返回NULL并通过err返回原因(ENOENT, EACCES, EISDIR等)。
+    // encodings是客户端接受的编码，有合适的预压缩文件或者压缩结果时返回它们的缓存项
+    entry * acquire(const char * path, int & err, int encodings = 0);
+    // 只查找内容已经在内存中的缓存项，不访问文件系统，可以在reactor线程中调用。
+    // 未命中、需要用mtime重新确认或者是大文件(包括要发送的预压缩文件)时返回NULL
+    entry * lookup(const char * path, int encodings = 0);
+    // 连接发送完毕后释放缓存项
+    void release(entry * e);
+
+private:
+    file_cache();
+    ~file_cache();
+
+    struct compress_job {
+        entry * source;             // 原文件的缓存项，压缩期间持有引用
+        int encoding;
+        std::string key;
+    };
+
+    entry * acquire_file(const std::string & key, const char * path, int encoding, int & err);
+    entry * lookup_file(const std::string & key);
+    // 在原文件的缓存项e和它的预压缩文件、压缩结果中选择要发送的，e的引用转交给返回值。
+    // cache_only时预压缩文件不在内存中则返回NULL
+    entry * negotiate(entry * e, int encodings, bool cache_only);
+    entry * load(const char * path, int encoding, int & err); // 缓存未命中时读取文件
+    void unlink_entry(entry * e); // 从缓存表中移除，需要持有锁
+    void unwatch(int wd); // 释放一个使用wd的缓存项对监视的引用，最后一个引用释放时删除监视，需要持有锁
+    void evict(); // 超过上限时淘汰最久未使用的缓存项，需要持有锁
+    static void put(entry * e);
+    static void * watcher(void * arg);
+    void watch(); // inotify线程
+    static void * compressor(void * arg);
+    void compress_jobs(); // 压缩线程
+    static entry * compress(entry * source, int encoding); // 压缩原文件的内容，没有变小时返回NULL
+
+    typedef std::list<entry *> lru_list;
+    std::unordered_map<std::string, lru_list::iterator> m_table;
+    lru_list m_lru; // 链表头部是最近使用的缓存项
+    size_t m_bytes; // 缓存在内存中的文件内容总大小
+    locker m_locker;
+
+    int m_inotifyfd;
+    pthread_t m_watcher;
+    // 每个inotify监视被多少个缓存项使用(同一个inode的不同路径共用一个wd)，不再使用的监视要删除，
+    // 否则监视的数量一直增长，用完fs.inotify.max_user_watches之后新的缓存项只能退化为检查mtime
+    std::unordered_map<int, int> m_watches;
+    // inotify事件计数，加载文件期间如果发生过事件，则加载到的内容可能已经过期，不放入缓存
+    std::atomic<unsigned long> m_generation;
+
+    // 压缩结果，和文件分开淘汰，不占用文件的缓存空间
+    std::unordered_map<std::string, lru_list::iterator> m_compressed;
+    lru_list m_compressed_lru;
+    size_t m_compressed_bytes;
+    std::deque<compress_job> m_jobs; // 等待压缩的文件，由m_locker保护
+    std::unordered_set<std::string> m_pending; // 已经在队列中或者正在压缩的key，避免重复压缩
+    sem m_jobstat;
+    pthread_t m_compressor;
+    bool m_compressor_running;
+    bool m_stop;
+};
+
+#endif
@@ -1,4 +1,7 @@
 #include "http_conn.h"
+#include "timer_wheel.h"
+#include "conn_slab.h"
+#include <ctype.h>
 
 
 const char* ok_200_title = "OK";
@@ -11,17 +14,17 @@ const char* error_404_form = "The requested file was not found on this server.\n
 const char* error_500_title = "Internal Error";
 const char* error_500_form = "There was an unusual problem serving the requested file.\n";
 
-const char * root = "/home/controller/linux/webserver/resources";
-
-extern int epollfd;
-
 // 定时器回调函数，它删除非活动连接socket上的注册事件，并关闭之。
+// tick()在调用之前已经把定时器从时间轮中摘除
 void cb_func( http_conn* user_data )
 {
-    epoll_ctl( epollfd, EPOLL_CTL_DEL, user_data->getfd(), 0 );
     assert( user_data );
-    close( user_data->getfd() );
-    printf( "close fd %d\n", user_data->getfd() );
+    if (user_data->sync_timer()) {
+        return; // 连接还在工作线程中，或者工作线程发送响应之后推迟了超时时间，定时器已经重新加入时间轮
+    }
+    metrics::add(metrics::TIMER_EXPIRATIONS);
+    LOG_DEBUG("close fd %d on timeout", user_data->get_sockfd());
+    user_data->close_conn();
 }
 
 
@@ -34,19 +37,19 @@ int setnonblocking(int fd) {
 }
 
 
-// 向epoll中添加需要监听的文件描述符
-void addfd(int epollfd, int fd, bool oneshot) {
+// 向epoll中添加需要监听的文件描述符，data是事件中带回的数据：连接为conn_slab分配的句柄，其他fd就是fd本身
+void addfd(int epollfd, int fd, bool oneshot, uint64_t data) {
     epoll_event event;
-    event.data.fd = fd;
+    event.data.u64 = data;
     // 对方连接断开，就会触发EPOLLRDHUP，之前是通过read函数的返回值是否为0来判断是否断开连接
     //event.events = EPOLLIN | EPOLLRDHUP; // 好的服务器可以支持边缘模式，也可以使用水平模式
     event.events = EPOLLIN | EPOLLRDHUP | EPOLLET; // 设置为边沿触发
     if(oneshot) {
         event.events |= EPOLLONESHOT; // 如果开启了oneshot模式，那么socket连接在任何时刻都只能够被一个线程处理
     }
+    // ET只能够在非阻塞的情况下使用，fd需要在创建时就设置为非阻塞(accept4、SOCK_NONBLOCK等)，
+    // 这里不再为每个连接调用两次fcntl
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    // 设置文件描述符非阻塞
-    setnonblocking(fd); // 因为ET只能够在非阻塞的情况下使用，否则
 }
 
 void removefd(int epollfd, int fd) {
@@ -55,116 +58,362 @@ void removefd(int epollfd, int fd) {
 }
 
 // 修改文件描述符，重置socket上的EPOLLONESHOT,确保下一次可读时EPOLLIN可以触发
-void modfd(int epollfd, int fd, int ev) {
+void modfd(int epollfd, int fd, int ev, uint64_t data) {
     epoll_event event;
-    event.data.fd = fd;
+    event.data.u64 = data;
     event.events = ev | EPOLLONESHOT  | EPOLLRDHUP; //重新注册这个事件
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, (epoll_event *)&event);
 }
 
 
-int http_conn::m_epollfd = -1; // 所有socket上的事件都被注册到同一个epoll对象中
-int http_conn::m_user_count = 0; // 统计用户的数量
+std::atomic<int> http_conn::m_user_count(0); // 统计用户的数量
+static thread_local bool t_on_worker = false; // 当前线程是epoll后端线程池中的工作线程
+static thread_local bool t_rearmed = false; // 当前线程重新注册了连接的事件，连接已经交还给reactor
+int http_conn::m_buffer_limit = 16384;
+int http_conn::m_request_timeout = CONN_TIMEOUT;
+int http_conn::m_keepalive_timeout = KEEPALIVE_TIMEOUT;
+int http_conn::m_linger_timeout = LINGER_TIMEOUT;
+int http_conn::m_max_requests = 0;
+int http_conn::m_write_quantum = 512 * 1024;
+int http_conn::m_send_lowat = 128 * 1024;
+const char * http_conn::m_metrics_path = NULL;
+const char * http_conn::m_root = "/home/controller/linux/webserver/resources";
 
 void http_conn::close_conn() {
     // 关闭连接
     if (m_sockfd != -1) {
-        removefd(m_epollfd, m_sockfd);
+        close_file(); // 响应发送到一半时连接被关闭
+        release_buffers();
+        // 连接关闭时一并移除定时器，避免定时器到期后误关闭复用了这个槽的新连接
+        m_timers->del_timer(&m_timer);
+        if (m_epollfd != -1) {
+            // socket没有被dup过，close时内核会把它从epoll中移除，不需要再调用EPOLL_CTL_DEL
+            close(m_sockfd);
+        } else {
+            // io_uring后端：还没完成的recv/send请求持有socket的引用，只close的话socket不会真正关闭，
+            // 先shutdown让这些请求立即结束，它们的完成事件带着旧的句柄，会被忽略
+            shutdown(m_sockfd, SHUT_RDWR);
+            close(m_sockfd);
+        }
         m_sockfd = -1;
         m_user_count --; // 关闭一个连接，客户总数 - 1
+        m_slab->free(this); // 槽的代数加1，之后带着旧句柄的事件都会被忽略
     }
 }
 
-void http_conn::init(int sockfd, const sockaddr_in & addr, sort_timer_list& timer_lst)
+void http_conn::init(int sockfd, const sockaddr_in & addr, int epollfd, timer_wheel& timers, conn_slab& slab)
 {
     m_address = addr;
     m_sockfd = sockfd;
-    // 设置端口复用
-    int reuse = 1;
-    setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    m_epollfd = epollfd;
+    m_timers = &timers;
+    m_slab = &slab;
+    m_dispatched = false;
+    m_deadline.store(0, std::memory_order_relaxed);
 
     // 添加到epoll对象中
-    addfd(m_epollfd, sockfd, true); // oneshot事件的添加
+    if (m_epollfd != -1) {
+        addfd(m_epollfd, sockfd, true, m_handle); // oneshot事件的添加
+    }
     m_user_count ++;
+    metrics::add(metrics::ACCEPTED_CONNECTIONS);
 
     init();
+    m_request_count = 0;
+    m_closing = false;
+    m_lowat_set = false;
+    m_cache_only = false;
+    m_deferred = false;
 
-    // 创建定时器，设置其回调函数与超时时间，然后绑定定时器与用户数据，最后将定时器添加到链表timer_lst中
-    util_timer* timer = new util_timer;
-    timer->user_data = this;
-    timer->cb_func = cb_func;
-    time_t cur = time( NULL );
-    timer->expire = cur + 3 * TIMESLOT;
-    this->timer = timer;
-    timer_lst.add_timer( timer );
+    // 设置定时器的回调函数与超时时间，绑定定时器与用户数据，然后将定时器添加到时间轮中
+    m_timer.user_data = this;
+    m_timer.cb_func = cb_func;
+    m_timer.expire = current_ms() + m_request_timeout;
+    timers.add_timer( &m_timer );
 }
 
 void http_conn::init()
 {
-    m_check_state = CHECK_STATE_REQUESTLINE; // 初始状态为解析请求首行
     m_checked_index = 0;
     m_start_line = 0;
+    m_read_idx = 0;
+    m_write_idx = 0;
+    m_write_sent = 0;
+    m_response_count = 0;
+    m_response_sent = 0;
+    m_file_offset = 0;
+    m_pipeline_full = false;
+    init_request();
+
+    // 只重置游标和解析状态，不清零任何缓冲区：读写缓冲区只访问[0, idx)范围内的数据，
+    // m_real_file在do_request中整体重写。请求处理完之后缓冲区归还给内存池
+    release_buffers();
+}
+
+void http_conn::init_request()
+{
+    m_check_state = CHECK_STATE_REQUESTLINE; // 初始状态为解析请求首行
     m_method = GET;
     m_url = 0;
     m_version = 0;
     m_content_length = 0;
     m_linger = false;
     m_host = 0;
-    m_read_idx = 0;
-    m_write_idx = 0;
+    m_referer = 0;
+    m_user_agent = 0;
+    m_accept_encoding = 0;
+    // 流水线中的下一个请求紧接着上一个请求(包括请求体)
+    m_request_start = m_checked_index;
+    m_start_line = m_checked_index;
+}
 
+void http_conn::release_buffers()
+{
+    buffer_pool::free(m_read_buf, m_read_size);
+    m_read_buf = NULL;
+    m_read_size = 0;
+    buffer_pool::free(m_write_buf, m_write_size);
+    m_write_buf = NULL;
+    m_write_size = 0;
+}
+
+// 已经解析出的字段指向原来的位置，需要一起移动到buf中的相同位置
+void http_conn::move_read_data(char * buf)
+{
+    char * base = m_read_buf + m_request_start;
+    memmove(buf, base, m_read_idx - m_request_start);
+    if (m_url) m_url = buf + (m_url - base);
+    if (m_version) m_version = buf + (m_version - base);
+    if (m_host) m_host = buf + (m_host - base);
+    if (m_referer) m_referer = buf + (m_referer - base);
+    if (m_user_agent) m_user_agent = buf + (m_user_agent - base);
+    m_read_idx -= m_request_start;
+    m_checked_index -= m_request_start;
+    m_start_line -= m_request_start;
+    m_request_start = 0;
+}
 
-    bzero(m_read_buf, READ_BUFFER_SIZE);
-    bzero(m_write_buf, READ_BUFFER_SIZE);
-    bzero(m_real_file, FILENAME_LEN);
+// 换成大一级的读缓冲区
+bool http_conn::grow_read_buf()
+{
+    int size = m_read_size * 2;
+    if (size > m_buffer_limit) {
+        return false;
+    }
+    char * buf = buffer_pool::alloc(size);
+    if (!buf) {
+        return false;
+    }
+    move_read_data(buf);
+    buffer_pool::free(m_read_buf, m_read_size);
+    m_read_buf = buf;
+    m_read_size = size;
+    return true;
 }
 
-bool http_conn::read(int epollfd, sort_timer_list& timer_lst)
+// 保证写缓冲区至少有size字节，写缓冲区中只有响应头，没有指向它的指针
+bool http_conn::grow_write_buf(int size)
 {
+    if (size < WRITE_BUFFER_SIZE) {
+        size = WRITE_BUFFER_SIZE;
+    }
+    if (size > m_buffer_limit) {
+        return false;
+    }
+    char * buf = buffer_pool::alloc(size);
+    if (!buf) {
+        return false;
+    }
+    if (m_write_buf) {
+        memcpy(buf, m_write_buf, m_write_idx);
+        buffer_pool::free(m_write_buf, m_write_size);
+    }
+    m_write_buf = buf;
+    m_write_size = size;
+    return true;
+}
+
+void http_conn::rearm(int ev)
+{
+    t_rearmed = true;
+    if (m_epollfd == -1) {
+        return;
+    }
+    if (t_on_worker) {
+        // 交还给reactor之前公布新的到期时间，之后reactor才可能收到这个连接的事件
+        time_t deadline = m_worker_deadline ? m_worker_deadline : current_ms() + m_request_timeout;
+        m_deadline.store(deadline, std::memory_order_release);
+    }
+    modfd(m_epollfd, m_sockfd, ev, m_handle);
+}
+
+void http_conn::set_timeout(int ms)
+{
+    if (t_on_worker) {
+        // 工作线程不能操作时间轮，只记下新的到期时间，交还连接时再公布
+        m_worker_deadline = current_ms() + ms;
+        return;
+    }
+    if (m_timer.is_linked()) {
+        m_timers->mod_timer(&m_timer, current_ms() + ms);
+    }
+}
+
+// 工作线程可能缩短超时时间(不保持连接、较短的keep-alive超时)，交给线程池时先把定时器提前到
+// 可能的最短超时时间，到期时再按工作线程公布的时间推迟，连接空闲时不需要reactor专门处理它
+static int dispatch_guard()
+{
+    int guard = http_conn::m_linger_timeout;
+    if (http_conn::m_keepalive_timeout < guard) guard = http_conn::m_keepalive_timeout;
+    if (http_conn::m_request_timeout < guard) guard = http_conn::m_request_timeout;
+    return guard;
+}
+
+void http_conn::mark_dispatched()
+{
+    m_dispatched = true;
+    m_deadline.store(0, std::memory_order_relaxed);
+    m_timers->mod_timer(&m_timer, current_ms() + dispatch_guard());
+}
+
+bool http_conn::sync_timer()
+{
+    if (!m_dispatched) {
+        return false;
+    }
+    time_t deadline = m_deadline.exchange(0, std::memory_order_acquire);
+    if (deadline == 0) {
+        // 只会在定时器到期时出现：工作线程还没有交还连接，不能关闭，过一段时间再检查
+        if (!m_timer.is_linked()) {
+            m_timer.expire = current_ms() + dispatch_guard();
+            m_timers->add_timer(&m_timer);
+        }
+        return true;
+    }
+    m_dispatched = false;
+    if (m_timer.is_linked()) {
+        m_timers->mod_timer(&m_timer, deadline);
+        return true;
+    }
+    // 定时器已经到期并从时间轮中摘除(由cb_func调用)，新的到期时间还没到时重新加入
+    if (deadline <= current_ms()) {
+        return false;
+    }
+    m_timer.expire = deadline;
+    m_timers->add_timer(&m_timer);
+    return true;
+}
+
+bool http_conn::drain()
+{
+    char buf[4096];
+    while (true) {
+        int bytes_read = recv(m_sockfd, buf, sizeof(buf), 0);
+        if (bytes_read == 0) {
+            return false;
+        }
+        if (bytes_read < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                rearm(EPOLLIN);
+                return true;
+            }
+            return false;
+        }
+    }
+}
+
+// 读取失败或者对方关闭连接时返回false，由所属reactor负责关闭连接
+bool http_conn::read()
+{
+    if (m_closing) {
+        return drain();
+    }
+    // 连接有数据可读时才从内存池借用读缓冲区
+    if (!m_read_buf) {
+        m_read_size = READ_BUFFER_SIZE;
+        m_read_buf = buffer_pool::alloc(m_read_size);
+        if (!m_read_buf) {
+            m_read_size = 0;
+            return false;
+        }
+    }
     // 循环读取客户的数据，直到无数据可读或者关闭连接
-    if(m_read_idx >= READ_BUFFER_SIZE) return false;
     // 读取到的字节
     int bytes_read = 0;
-    util_timer *timer = this->timer;
+    int old_read_idx = m_read_idx;
     while(true) {
-        // 从m_read_buf + m_read_idx索引出开始保存数据，大小是READ_BUFFER_SIZE - m_read_idx
+        // 缓冲区满了就扩容。到达上限时先处理已经读到的请求，剩下的数据留在socket中，
+        // 重新注册EPOLLIN时会再次触发；一个字节都没有读到说明单个请求超过了上限，放弃这个连接
+        if (m_read_idx >= m_read_size && !grow_read_buf()) {
+            if (m_read_idx == old_read_idx) {
+                return false;
+            }
+            break;
+        }
+        // 从m_read_buf + m_read_idx索引出开始保存数据，大小是m_read_size - m_read_idx
         bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, 
-        READ_BUFFER_SIZE - m_read_idx, 0 );
+        m_read_size - m_read_idx, 0 );
         if (bytes_read == -1) {
             if( errno == EAGAIN || errno == EWOULDBLOCK ) {
                 // 没有数据
                 break;
             }
-            cb_func(this);
-            if (timer)
-            {
-                timer_lst.del_timer( timer );
-            }
             return false;   
         } else if (bytes_read == 0) {   // 对方关闭连接
-            cb_func(this);
-            if (timer)
-            {
-                timer_lst.del_timer( timer );
-            }
             return false;
-        } else {
-            if ( timer )
-            {
-                time_t cur = time(NULL);
-                timer->expire = cur + 3 * TIMESLOT;
-                printf("调整时间一次\n");
-                timer_lst.adjust_timer( timer );
-            }
         }
         m_read_idx += bytes_read;
+        if (m_read_idx < m_read_size) {
+            // 没有读满说明socket中的数据已经读完，不用再调用一次recv等EAGAIN。
+            // 之后到达的数据不会丢失：EPOLL_CTL_MOD重新注册EPOLLONESHOT时内核会重新检查是否可读
+            break;
+        }
+    }
+    if ( m_read_idx > old_read_idx )
+    {
+        // 正在读取请求，使用请求的超时时间
+        set_timeout( m_request_timeout );
+    }
+    if (m_read_idx == 0) {
+        // 没有读到数据，不占用缓冲区
+        buffer_pool::free(m_read_buf, m_read_size);
+        m_read_buf = NULL;
+        m_read_size = 0;
+    }
+    return true;
+}
+
+bool http_conn::append_data(const char * data, int len)
+{
+    if (m_closing) {
+        return true; // 等待客户端关闭的连接，丢弃收到的数据
+    }
+    if (!m_read_buf) {
+        m_read_size = READ_BUFFER_SIZE;
+        m_read_buf = buffer_pool::alloc(m_read_size);
+        if (!m_read_buf) {
+            m_read_size = 0;
+            return false;
+        }
+    }
+    // 数据已经从socket中取出来了，放不下时不能像read()那样留在socket中，只能放弃这个连接
+    while (m_read_size - m_read_idx < len) {
+        if (!grow_read_buf()) {
+            return false;
+        }
     }
+    memcpy(m_read_buf + m_read_idx, data, len);
+    m_read_idx += len;
+    set_timeout( m_request_timeout );
     return true;
 }
 
+// 用find_char2一次比较多个字节，直接跳到下一个\r或\n
 http_conn::LINE_STATE http_conn::parse_line() {
     char temp;
-    for ( ; m_checked_index < m_read_idx; ++m_checked_index ) {
+    const char * end = m_read_buf + m_read_idx;
+    m_checked_index = find_char2(m_read_buf + m_checked_index, end, '\r', '\n') - m_read_buf;
+    if ( m_checked_index < m_read_idx ) {
         temp = m_read_buf[ m_checked_index ];
         if ( temp == '\r' ) {
             if ( ( m_checked_index + 1 ) == m_read_idx ) {
@@ -175,7 +424,8 @@ http_conn::LINE_STATE http_conn::parse_line() {
                 return LINE_OK;
             }
             return LINE_BAD;
-        } else if( temp == '\n' )  {
+        } else {
+            // 上一次读到的数据以\r结尾，这一次从\n开始
             if( ( m_checked_index > 1) && ( m_read_buf[ m_checked_index - 1 ] == '\r' ) ) {
                 m_read_buf[ m_checked_index-1 ] = '\0';
                 m_read_buf[ m_checked_index++ ] = '\0';
@@ -203,7 +453,12 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char * text) {
     m_version = strpbrk(m_url, " \t");
     if (!m_version) return BAD_REQUEST;
     *m_version ++ = '\0';
-    if (strcasecmp(m_version, "HTTP/1.1") != 0) {
+    // HTTP/1.1默认保持连接，HTTP/1.0默认不保持，都可以被Connection字段改变
+    if (strcasecmp(m_version, "HTTP/1.1") == 0) {
+        m_linger = true;
+    } else if (strcasecmp(m_version, "HTTP/1.0") == 0) {
+        m_linger = false;
+    } else {
         return BAD_REQUEST;
     }
     // http://192.168.1.1:10000/index.html
@@ -221,6 +476,46 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char * text) {
 
 }
 
+// 解析Accept-Encoding，值是逗号分隔的列表，如 gzip, deflate, br;q=0.9。
+// 返回客户端接受的编码的位掩码：q=0表示不接受，其余的权重不区分，由文件缓存按br、gzip的顺序选择；
+// *匹配没有单独列出的编码
+static int parse_accept_encoding(const char * value)
+{
+    int accepted = 0;
+    int listed = 0;
+    bool any = false;
+    for (const char * token = value + strspn(value, ", \t"); *token; token += strspn(token, ", \t")) {
+        size_t len = strcspn(token, ",; \t");
+        const char * end = token + strcspn(token, ",");
+        bool refused = false;
+        for (const char * param = token + len; param < end; ++ param) {
+            if (*param == ';') {
+                param += 1 + strspn(param + 1, " \t");
+                if ((*param == 'q' || *param == 'Q') && param[1] == '=') {
+                    refused = atof(param + 2) == 0;
+                }
+            }
+        }
+        int encoding = 0;
+        if (len == 4 && strncasecmp(token, "gzip", 4) == 0) {
+            encoding = file_cache::GZIP;
+        } else if (len == 2 && strncasecmp(token, "br", 2) == 0) {
+            encoding = file_cache::BROTLI;
+        } else if (len == 1 && *token == '*') {
+            any = !refused;
+        }
+        listed |= encoding;
+        if (!refused) {
+            accepted |= encoding;
+        }
+        token = end;
+    }
+    if (any) {
+        accepted |= (file_cache::GZIP | file_cache::BROTLI) & ~listed;
+    }
+    return accepted;
+}
+
 http_conn::HTTP_CODE http_conn::parse_headers(char * text) {
     if(text[0] == '\0') {
         // 如果当前的HTTP请求有消息体，那么还需停药读取m_content_length字节的消息体
@@ -230,24 +525,58 @@ http_conn::HTTP_CODE http_conn::parse_headers(char * text) {
             return NO_REQUEST;
         }
         // 否则直接就解析完成，说明解析到的是空行
-    } else if (strncasecmp( text, "Connection:", 11 ) == 0) {
-        // 处理头部字段 Connection: keep-alive
-        text += 11; // 指针向后移动11位
-        text += strspn( text, " \t");// 找到对应的指针部分
-        if (strcasecmp( text, "keep-alive") == 0) {
-            m_linger = true;
-        }
-    } else if (strncasecmp( text, "Content-Length:", 15 ) == 0) {
-        text += 15;
-        text += strspn( text, " \t");
-        m_content_length = atol(text); // 这里更新m_content_length;
-    } else if (strncasecmp( text, "Host", 5) == 0) {
-        text += 5; 
-        text += strspn( text, " \t");
-        m_host = text;
-    } else {
-        // 解析所有的头部信息
-        printf( "oop! unknow header %s\n", text );
+        return GET_REQUEST;
+    }
+    // parse_line已经把行尾换成了'\0'，在剩余的数据中同时查找':'和'\0'，不需要先求出行的长度
+    char * colon = (char *)find_char2(text, m_read_buf + m_read_idx, ':', '\0');
+    if (*colon != ':') {
+        return NO_REQUEST; // 没有冒号的行忽略
+    }
+    char * value = colon + 1;
+    value += strspn( value, " \t");
+    switch (lookup_header(text, colon - text)) {
+        case HEADER_CONNECTION:
+            // 处理头部字段 Connection: keep-alive，值是逗号分隔的列表，如 Upgrade, close
+            for (char * token = value; *token; ) {
+                size_t len = strcspn(token, ", \t");
+                if (len == 5 && strncasecmp(token, "close", 5) == 0) {
+                    m_linger = false;
+                } else if (len == 10 && strncasecmp(token, "keep-alive", 10) == 0) {
+                    m_linger = true;
+                }
+                token += len;
+                token += strspn(token, ", \t");
+            }
+            break;
+        case HEADER_CONTENT_LENGTH: {
+            // 请求体要跳过才能找到流水线中的下一个请求，长度不合法时无法确定请求的边界，
+            // 超过m_buffer_limit的请求体也放不进读缓冲区
+            char * end;
+            errno = 0;
+            long long length = strtoll(value, &end, 10);
+            end += strspn(end, " \t");
+            if (!isdigit((unsigned char)*value) || *end || errno == ERANGE || length > m_buffer_limit) {
+                return BAD_REQUEST;
+            }
+            m_content_length = (int)length;
+            break;
+        }
+        case HEADER_TRANSFER_ENCODING:
+            return BAD_REQUEST; // 不支持分块传输的请求体，无法确定下一个请求从哪里开始
+        case HEADER_HOST:
+            m_host = value;
+            break;
+        case HEADER_REFERER:
+            m_referer = value;
+            break;
+        case HEADER_USER_AGENT:
+            m_user_agent = value;
+            break;
+        case HEADER_ACCEPT_ENCODING:
+            m_accept_encoding = parse_accept_encoding(value);
+            break;
+        default:
+            break; // 其余的头部字段不需要处理
     }
     return NO_REQUEST;
 }
@@ -256,7 +585,8 @@ http_conn::HTTP_CODE http_conn::parse_headers(char * text) {
 http_conn::HTTP_CODE http_conn::parse_content(char * text) {
     if (m_read_idx >= (m_content_length + m_checked_index))
     {
-        text[ m_content_length ] = '\0';
+        // 请求体不需要处理，直接跳过，后面是流水线中的下一个请求
+        m_checked_index += m_content_length;
         return GET_REQUEST;
     }
     return NO_REQUEST;
@@ -269,6 +599,7 @@ http_conn::HTTP_CODE http_conn::process_read() {
     HTTP_CODE ret = NO_REQUEST;
 
     char * text = nullptr;
+    uint64_t start = metrics::now();
 
     while (((m_check_state == CHECK_STATE_CONTENT) && (line_state == LINE_OK)) || 
              ((line_state = parse_line()) == LINE_OK)) // 正常读取
@@ -276,8 +607,10 @@ http_conn::HTTP_CODE http_conn::process_read() {
         // 当前表示解析到了一行完整的数据，或者解析到了请求体，也是完成的数据
         // 获取一行数据
         text = get_line();
+        if (m_check_state != CHECK_STATE_CONTENT) {
+            LOG_DEBUG("got 1 http line: %s", text);
+        }
         m_start_line = m_checked_index; // ？ 为什么这儿是这个，这个m_check_index是在哪儿改变的
-        printf("get one line : %s\n", text);
         switch(m_check_state)
         {
             case CHECK_STATE_REQUESTLINE:
@@ -296,13 +629,16 @@ http_conn::HTTP_CODE http_conn::process_read() {
                     return BAD_REQUEST;
                 } else if (ret == GET_REQUEST) {
                     // 获取一个完整的请求头
+                    metrics::observe(metrics::PARSE_TIME, start);
                     return do_request();
                 }
+                break;
             }
             case CHECK_STATE_CONTENT:
             {
                 ret = parse_content(text);
                 if (ret == GET_REQUEST) { // 成功
+                    metrics::observe(metrics::PARSE_TIME, start);
                     return do_request(); // 将资源，URL等其出来，做下一步的操作。
                 }
                 line_state = LINE_OPEN; // 失败了
@@ -314,101 +650,301 @@ http_conn::HTTP_CODE http_conn::process_read() {
             }
         }
     }
+    if (line_state == LINE_BAD) {
+        return BAD_REQUEST; // 行中出现单独的\r或\n
+    }
     return NO_REQUEST;
 }
 
-http_conn::HTTP_CODE http_conn::do_request()
+// 把url规范化之后接在root后面写入out：合并连续的/，去掉.段，这样同一个文件在缓存中只有一项。
+// url中有..段时返回-1，否则返回完整路径的长度，不小于size时表示放不下
+static int join_path(char * out, int size, const char * root, const char * url)
 {
-    // 如果得到一个完整的，正确的HTTP请求时，我们就分析目标文件的属性，如果目标文件存在，对所有
-    // 用户可读，且不是目录，则使用mmap将其映射到内存地址m_file_address处，并告诉调用者获取文件成功
-    strcpy(m_real_file, root);
-    int len = strlen(root);
-    // m_real_file : http://192.168.44.138 在m_real_file的后面贴上url
-    strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
-    // 获取当前文件的相关的状态信息码，-1表示失败，0表示成功
-    if (stat( m_real_file, &m_file_stat) < 0){
-        return NO_REQUEST;
+    int len = snprintf(out, size, "%s", root);
+    const char * p = url;
+    while (*p && len < size) {
+        if (*p == '/') {
+            ++ p;
+            continue;
+        }
+        int n = strcspn(p, "/");
+        if (n == 1 && p[0] == '.') {
+            p += n;
+            continue;
+        }
+        if (n == 2 && p[0] == '.' && p[1] == '.') {
+            return -1;
+        }
+        if (len + 1 + n >= size) {
+            return size;
+        }
+        out[len ++] = '/';
+        memcpy(out + len, p, n);
+        len += n;
+        p += n;
     }
-
-    // 判断访问权限
-    if (!(m_file_stat.st_mode & S_IROTH)) {
-        return FORBIDDEN_REQUEST;
+    if (len < size - 1 && p[-1] == '/') {
+        out[len ++] = '/'; // 保留结尾的/，请求的是目录
+    }
+    if (len < size) {
+        out[len] = '\0';
     }
+    return len;
+}
 
-    // 判断是否是目录
-    if (S_ISDIR(m_file_stat.st_mode)) {
-        return BAD_REQUEST;
+http_conn::HTTP_CODE http_conn::do_request()
+{
+    // 如果得到一个完整的，正确的HTTP请求时，我们就从文件缓存中获取目标文件，如果目标文件存在，对所有
+    // 用户可读，且不是目录，则获取成功。缓存命中时不需要stat、open等任何文件系统调用
+    // m_real_file : http://192.168.44.138 在root的后面贴上规范化之后的url，路径太长时不截断，直接当作不存在
+    if (m_metrics_path && strcmp(m_url, m_metrics_path) == 0) {
+        return METRICS_REQUEST;
+    }
+    int len = join_path(m_real_file, FILENAME_LEN, m_root, m_url);
+    if (len < 0) {
+        return BAD_REQUEST; // 包含..，可能访问到root之外的文件
+    }
+    if (len >= FILENAME_LEN) {
+        return NO_RESOURCE;
+    }
+    if (m_cache_only) {
+        // reactor线程中不能等待磁盘：缓存未命中、需要重新确认mtime以及用sendfile发送的大文件都交给工作线程
+        m_file = file_cache::get_instance().lookup(m_real_file, m_accept_encoding);
+        return m_file ? FILE_REQUEST : DEFERRED_REQUEST;
+    }
+    int err = 0;
+    m_file = file_cache::get_instance().acquire(m_real_file, err, m_accept_encoding);
+    if (!m_file) {
+        switch (err) {
+            case EACCES:
+                return FORBIDDEN_REQUEST; // 没有访问权限
+            case EISDIR:
+                return BAD_REQUEST; // 请求的是目录
+            case ENOENT:
+            case ENOTDIR:
+            case ENAMETOOLONG:
+                return NO_RESOURCE;
+            default:
+                return INTERNAL_ERROR;
+        }
     }
-    // 以只读方式打开文件
-    int fd = open( m_real_file, O_RDONLY);
-    // 内存映射
-    m_file_address = ( char*) mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close( fd );
     return FILE_REQUEST;
 }
 
-void http_conn::unmap() {
-    if (m_file_address)
+// 释放当前请求以及所有还没有发送完的响应引用的缓存项
+void http_conn::close_file() {
+    if (m_file)
     {
-        munmap(m_file_address,m_file_stat.st_size);
-        m_file_address = 0;
+        // 释放对缓存项的引用，缓存项已被淘汰时由最后一个使用者销毁
+        file_cache::get_instance().release(m_file);
+        m_file = NULL;
+    }
+    for (int i = m_response_sent; i < m_response_count; ++ i) {
+        if (m_responses[i].file) {
+            file_cache::get_instance().release(m_responses[i].file);
+            m_responses[i].file = NULL;
+        }
+    }
+    m_response_count = 0;
+    m_response_sent = 0;
+}
+
+bool http_conn::advance(size_t sent)
+{
+    metrics::add(metrics::SENT_BYTES, sent);
+    while (m_response_sent < m_response_count) {
+        response & r = m_responses[m_response_sent];
+        // 先算响应头，剩下的是响应体
+        size_t header_left = r.header_end - m_write_sent;
+        size_t n = sent < header_left ? sent : header_left;
+        m_write_sent += n;
+        sent -= n;
+        off_t file_size = r.file ? r.file->st.st_size : 0;
+        n = sent < (size_t)(file_size - m_file_offset) ? sent : file_size - m_file_offset;
+        m_file_offset += n;
+        sent -= n;
+        if (m_write_sent < r.header_end || m_file_offset < file_size) {
+            return false;
+        }
+        // 这个响应发送完了
+        if (r.file) {
+            file_cache::get_instance().release(r.file);
+            r.file = NULL;
+        }
+        m_file_offset = 0;
+        ++ m_response_sent;
+    }
+    return true;
+}
+
+// 从当前的发送进度开始填写iovec：每个响应是剩余的响应头和剩余的文件内容。遇到用sendfile发送的大文件时
+// 在它的响应头之后停下，flags带上MSG_MORE让响应头和文件的第一段合并成完整的TCP报文
+int http_conn::prepare_send(struct iovec * iv, int & flags)
+{
+    int iv_count = 0;
+    int header_pos = m_write_sent;
+    flags = 0;
+    for (int i = m_response_sent; i < m_response_count; ++ i) {
+        response & r = m_responses[i];
+        if (header_pos < r.header_end) {
+            iv[iv_count].iov_base = m_write_buf + header_pos;
+            iv[iv_count++].iov_len = r.header_end - header_pos;
+            header_pos = r.header_end;
+        }
+        if (!r.file) {
+            continue;
+        }
+        if (!r.file->data) {
+            flags = MSG_MORE;
+            break;
+        }
+        off_t offset = (i == m_response_sent) ? m_file_offset : 0;
+        if (offset < r.file->st.st_size) {
+            iv[iv_count].iov_base = r.file->data + offset;
+            iv[iv_count++].iov_len = r.file->st.st_size - offset;
+        }
     }
+    return iv_count;
 }
 
+bool http_conn::sending_file()
+{
+    if (m_response_sent == m_response_count) {
+        return false;
+    }
+    response & cur = m_responses[m_response_sent];
+    return cur.file && !cur.file->data && m_write_sent == cur.header_end;
+}
+
+void http_conn::complete_send(size_t sent)
+{
+    advance(sent);
+    set_timeout( m_request_timeout ); // 慢速的客户端只要还在接收数据就不会超时
+    if (m_response_sent == m_response_count) {
+        finish_batch();
+    }
+}
+
+// 发送这一批流水线请求的响应：响应头依次放在写缓冲区中，小文件的内容在缓存中，
+// 所有响应头和内存中的响应体用一次sendmsg发送；大文件先发送它之前的部分，
+// 再用sendfile把文件内容直接从page cache发送到socket。
+// 发送过程中遇到EAGAIN时记录发送进度并注册EPOLLOUT，下一次可写时从断点继续。
+// 每次最多发送m_write_quantum字节，快速下载大文件的连接也不会长时间占住reactor，
+// 发完之后重新注册EPOLLOUT，socket仍然可写，下一轮epoll_wait会继续
 bool http_conn::write()
 {
-    int temp = 0;
-    int bytes_have_send = 0;    // 已经发送的字节
-    int bytes_to_send = m_write_idx;// 将要发送的字节 （m_write_idx）写缓冲区中待发送的字节数
-    if (bytes_to_send == 0) {
+    if (m_response_count == 0) {
         // 将要发送的字节位0，这一次相应结束.
-        modfd( m_epollfd, m_sockfd, EPOLLIN);
-        init();
+        rearm(EPOLLIN);
         return true;
     }
-    while (1) 
-    {
-        // 分散内存块的写，将数据写入到m_iv中去
-        temp = writev(m_sockfd, m_iv, m_iv_count); // 将数据写出去
+    size_t quantum = m_write_quantum;
+    while (m_response_sent < m_response_count) {
+        if (quantum == 0) {
+            rearm(EPOLLOUT);
+            return true;
+        }
+        ssize_t temp;
+        if (sending_file()) {
+            response & cur = m_responses[m_response_sent];
+            if (!m_lowat_set) {
+                // 限制socket中未发送的数据量，慢速的客户端不会占用大量的内核内存，
+                // 未发送的数据低于水位时才会触发EPOLLOUT
+                setsockopt(m_sockfd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &m_send_lowat, sizeof(m_send_lowat));
+                m_lowat_set = true;
+            }
+            // 缓存中的fd被多个连接共享，sendfile使用显式偏移，不会改变文件的读写位置
+            off_t offset = m_file_offset;
+            size_t count = cur.file->st.st_size - m_file_offset;
+            temp = sendfile(m_sockfd, cur.file->fd, &offset, count < quantum ? count : quantum);
+            if (temp > 0 && offset < cur.file->st.st_size) {
+                // 提前让内核读入下一段文件，下一次sendfile时尽量不用在reactor线程中等待磁盘
+                posix_fadvise(cur.file->fd, offset, m_write_quantum, POSIX_FADV_WILLNEED);
+            }
+            if (temp == 0) {
+                // 文件在发送过程中被截断，已经无法发送声明的Content-Length
+                close_file();
+                return false;
+            }
+        } else {
+            // 分散内存块的写
+            struct iovec iv[MAX_PIPELINE * 2];
+            struct msghdr msg;
+            bzero(&msg, sizeof(msg));
+            int flags;
+            msg.msg_iov = iv;
+            msg.msg_iovlen = prepare_send(iv, flags);
+            temp = sendmsg(m_sockfd, &msg, flags);
+        }
         if (temp <= -1) {
             // 如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件，虽然在此期间，
             // 服务器无法立即接收到同一客户的下一个请求，但可以保证连接的完整性。
             if (errno == EAGAIN) {
-                modfd( m_epollfd, m_sockfd, EPOLLOUT);
+                rearm(EPOLLOUT);
                 return true;
             }
-            unmap();
+            close_file();
             return false; // 这是无法搞定的情况，因此直接返回false
         }
-        bytes_to_send -= temp;
-        bytes_have_send += temp;
-        if ( bytes_to_send <= bytes_have_send ) {
-            // 发送HTTP响应成功，根据HTTP请求中的Connection字段决定是否立即关闭连接
-            unmap();
-            if(m_linger) {
-                init();
-                modfd( m_epollfd, m_sockfd, EPOLLIN );
-                return true;
-            } else {
-                modfd( m_epollfd, m_sockfd, EPOLLIN );
-                return false;
-            } 
-        }
+        advance(temp);
+        quantum = (size_t)temp < quantum ? quantum - temp : 0;
+        set_timeout( m_request_timeout ); // 慢速的客户端只要还在接收数据就不会超时
+    }
+    finish_batch();
+    return true;
+}
+
+// 这一批响应都发送成功，根据最后一个请求的Connection字段决定是否保持连接
+void http_conn::finish_batch()
+{
+    bool linger = m_responses[m_response_count - 1].linger;
+    m_response_count = 0;
+    m_response_sent = 0;
+    m_write_idx = 0;
+    m_write_sent = 0;
+    if (!linger) {
+        // 不直接close：socket中还有未读的数据(比如客户端流水线发送的后续请求)时close会发送RST，
+        // 客户端可能因此丢掉还没读取的响应。先关闭写方向，等客户端读完响应关闭连接(EPOLLRDHUP)，
+        // 期间收到的数据直接丢弃，最多等待m_linger_timeout
+        release_buffers();
+        m_closing = true;
+        shutdown(m_sockfd, SHUT_WR);
+        set_timeout( m_linger_timeout );
+        rearm(EPOLLIN);
+        return;
     }
+    buffer_pool::free(m_write_buf, m_write_size);
+    m_write_buf = NULL;
+    m_write_size = 0;
+    if (m_request_start == m_read_idx) {
+        init(); // 没有剩余的数据，归还读缓冲区
+        set_timeout( m_keepalive_timeout ); // 等待下一个请求
+    } else {
+        move_read_data(m_read_buf); // 下一个请求的数据移到缓冲区开头
+    }
+    if (has_buffered_request()) {
+        return; // 由reactor再交给线程池处理剩下的请求
+    }
+    rearm(EPOLLIN);
 }
 
 bool http_conn::add_response( const char* format, ...  ) {
-    if (m_write_idx >= WRITE_BUFFER_SIZE) return false;
-    va_list arg_list;
-    va_start( arg_list, format);
-    // 往writebuf中写入数据
-    int len = vsnprintf( m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
-    if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx)) {
-        return false;
+    if (!m_write_buf && !grow_write_buf(WRITE_BUFFER_SIZE)) return false;
+    while (true) {
+        va_list arg_list;
+        va_start( arg_list, format);
+        // 往writebuf中写入数据
+        int len = vsnprintf( m_write_buf + m_write_idx, m_write_size - 1 - m_write_idx, format, arg_list);
+        va_end( arg_list);
+        if (len < (m_write_size - 1 - m_write_idx)) {
+            m_write_idx += len; // 加上长度
+            return true;
+        }
+        // 写缓冲区放不下，扩容之后重新写入
+        if (!grow_write_buf(m_write_idx + len + 2)) {
+            return false;
+        }
     }
-    m_write_idx += len; // 加上长度
-    va_end( arg_list);
-    return true;
 }
 
 bool http_conn::add_status_line( int status, const char* title ) {
@@ -416,10 +952,8 @@ bool http_conn::add_status_line( int status, const char* title ) {
 }
 
 bool http_conn::add_headers(int content_len) {
-    add_content_length(content_len);
-    add_content_type();
-    add_linger();
-    add_blank_line();
+    return add_content_length(content_len) && add_content_type() &&
+        add_linger() && add_blank_line();
 }
 
 bool http_conn::add_content_length(int content_len) {
@@ -445,6 +979,24 @@ bool http_conn::add_content_type() {
     return add_response("Content-Type:%s\r\n", "text/html");
 }
 
+// 响应的状态码，只用于统计
+static int status_of(http_conn::HTTP_CODE code)
+{
+    switch (code) {
+        case http_conn::FILE_REQUEST:
+        case http_conn::METRICS_REQUEST:
+            return 200;
+        case http_conn::BAD_REQUEST:
+            return 400;
+        case http_conn::FORBIDDEN_REQUEST:
+            return 403;
+        case http_conn::NO_RESOURCE:
+            return 404;
+        default:
+            return 500;
+    }
+}
+
 // 获取写的情况
 bool http_conn::process_write( HTTP_CODE read_code )
 {
@@ -452,65 +1004,165 @@ bool http_conn::process_write( HTTP_CODE read_code )
     {
         case INTERNAL_ERROR:
             add_status_line( 500, error_500_title );
-            add_headers( strlen(error_500_form));
+            m_body_length = strlen(error_500_form);
+            add_headers(m_body_length);
             if (!add_content(error_500_form)) return false;
             break;
         case BAD_REQUEST:
             add_status_line( 400, error_400_title);
-            add_headers( strlen(error_400_form));
+            m_body_length = strlen(error_400_form);
+            add_headers(m_body_length);
             if (!add_content(error_400_form)) {
                 return false;
             }
             break;
         case NO_RESOURCE:
             add_status_line(404, error_404_title);
-            add_headers(strlen(error_404_form));
+            m_body_length = strlen(error_404_form);
+            add_headers(m_body_length);
             if (! add_content(error_404_form)) return false;
             break;
         case FORBIDDEN_REQUEST:
             add_status_line( 403, error_403_title );
-            add_headers(strlen( error_403_form));
+            m_body_length = strlen(error_403_form);
+            add_headers(m_body_length);
             if ( ! add_content( error_403_form ) ) {
                 return false;
             }
             break;
+        case METRICS_REQUEST:
+        {
+            // 统计信息每次重新汇总，和错误响应一样整个放在写缓冲区中
+            std::string body;
+            metrics::render(body);
+            add_status_line(200, ok_200_title);
+            m_body_length = body.size();
+            add_content_length(body.size());
+            add_response("Content-Type: text/plain; version=0.0.4\r\n");
+            add_linger();
+            add_blank_line();
+            if (!add_content(body.c_str())) return false;
+            break;
+        }
         case FILE_REQUEST:
-            add_status_line(200, ok_200_title );
-            add_headers(m_file_stat.st_size);
-            m_iv[ 0 ].iov_base = m_write_buf; // 这个操作将头和内容分成了两段 第一段是头
-            m_iv[ 0 ].iov_len = m_write_idx;
-            m_iv[ 1 ].iov_base = m_file_address; // 第二段是文件的地址，也就是内容
-            m_iv[ 1 ].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-
+            // 写缓冲区中只放响应头，状态行、Content-Length、Content-Type和Content-Encoding由文件缓存预先生成，
+            // 文件内容由write()直接从缓存发送
+            m_body_length = m_file->st.st_size;
+            if (m_file->encoding != file_cache::IDENTITY) {
+                metrics::add(metrics::COMPRESSED_RESPONSES);
+            }
+            if (!add_response("%s", m_file->header.c_str()) || !add_linger() || !add_blank_line()) {
+                close_file();
+                return false;
+            }
             return true;
         default:
             return false;
     }
-    m_iv[ 0 ].iov_base = m_write_buf; // 如果不是file_request，那么其他的请求也要有头部信息，因此需要buffer
-    m_iv[ 0 ].iov_len = m_write_idx;
-    m_iv_count = 1;
     return true;
 }
 
-// 由线程池中的工作线程处理，处理HTTP请求的入口函数
+// 记录一条访问日志。请求行无法解析时方法、URL和协议版本记为"-"
+void http_conn::log_access(HTTP_CODE read_code)
+{
+    char addr[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &m_address.sin_addr, addr, sizeof(addr));
+    const char * url = m_check_state != CHECK_STATE_REQUESTLINE ? m_url : NULL;
+    logger::access(addr, "GET", url, m_version, status_of(read_code), m_body_length, m_referer, m_user_agent);
+}
+
+// 由线程池中的工作线程处理，处理HTTP请求的入口函数。
+// 读缓冲区中可能有多个流水线请求，依次解析并生成响应，一起交给write()发送
 void http_conn::process()
 {
-    // 解析HTTP请求要用到有限状态机
-    
-    HTTP_CODE read_code =  process_read();
-    if (read_code == NO_REQUEST) {
-        modfd(m_epollfd, m_sockfd, EPOLLIN); // 读取数据不完整，还需要再去修改，加上oneshot
-        return;
+    // epoll后端中process()只在工作线程中调用，io_uring后端在reactor线程中调用
+    t_on_worker = m_epollfd != -1;
+    m_worker_deadline = 0;
+    while (process_batch()) {
+        // 达到了MAX_PIPELINE，继续处理读缓冲区中剩下的请求
     }
-    
-    // 生成响应
-    bool write_ret = process_write( read_code );
-    if (!write_ret) {
-        close_conn();
+}
+
+bool http_conn::process_inline()
+{
+    m_cache_only = true;
+    bool more;
+    while ((more = process_batch()) && !m_deferred) {
     }
-    // 注册写事件
-    modfd( m_epollfd, m_sockfd, EPOLLOUT); 
+    m_cache_only = false;
+    return !more;
 }
 
+// 解析并响应读缓冲区中的一批请求。连接已经交还给reactor(重新注册了事件)时返回false，
+// 之后不能再访问连接的任何状态；返回true时读缓冲区中还有没处理的请求，或者有请求需要交给工作线程
+bool http_conn::process_batch()
+{
+    // 解析HTTP请求要用到有限状态机
+    m_pipeline_full = false;
+    while (true) {
+        HTTP_CODE read_code;
+        if (m_deferred) {
+            // reactor线程解析完但没有处理的请求，从查找文件继续
+            m_deferred = false;
+            read_code = do_request();
+        } else {
+            read_code = process_read();
+        }
+        if (read_code == NO_REQUEST) {
+            break; // 剩下的数据不是完整的请求
+        }
+        if (read_code == DEFERRED_REQUEST) {
+            m_deferred = true;
+            return true; // 已经生成的响应和这个请求一起交给工作线程
+        }
+        if (read_code == BAD_REQUEST) {
+            m_linger = false; // 无法确定下一个请求从哪里开始，发送完响应就关闭连接
+        }
+        if (m_max_requests > 0 && ++ m_request_count >= m_max_requests) {
+            m_linger = false; // 达到了每个连接的请求数量上限
+        }
 
+        // 生成响应
+        bool write_ret = process_write( read_code );
+        if (!write_ret) {
+            // 工作线程不直接关闭连接，连接和定时器只由所属reactor线程操作。
+            // 关闭读写后重新注册事件，reactor会收到EPOLLRDHUP并关闭连接
+            shutdown(m_sockfd, SHUT_RDWR);
+            rearm(EPOLLIN);
+            return false;
+        }
+        metrics::count_status(status_of(read_code));
+        if (logger::access_enabled()) {
+            log_access(read_code);
+        }
+        response & r = m_responses[m_response_count++];
+        r.header_end = m_write_idx;
+        r.file = m_file;
+        r.linger = m_linger;
+        m_file = NULL;
+        if (!m_linger) {
+            break; // 不保持连接，之后的数据不再处理
+        }
+        init_request();
+        if (m_response_count == MAX_PIPELINE) {
+            m_pipeline_full = m_checked_index < m_read_idx;
+            break;
+        }
+    }
+    if (m_response_count == 0) {
+        rearm(EPOLLIN); // 读取数据不完整，还需要再去修改，加上oneshot
+        return false;
+    }
+    if (m_epollfd == -1) {
+        return false; // io_uring后端由uring_reactor提交发送请求
+    }
+    // 响应通常很小，直接在工作线程中发送，socket写满时write()才注册EPOLLOUT交给reactor继续，
+    // 省去注册EPOLLOUT的epoll_ctl和一轮epoll_wait
+    t_rearmed = false;
+    if (!write()) {
+        shutdown(m_sockfd, SHUT_RDWR);
+        rearm(EPOLLIN);
+        return false;
+    }
+    return !t_rearmed; // 只有流水线中还有请求时write()才不重新注册事件
+}
@@ -15,29 +15,65 @@
 #include <errno.h>
 #include <exception>
 #include "locker.h"
+#include "file_cache.h"
+#include "buffer_pool.h"
+#include "http_parser.h"
+#include "metrics.h"
+#include "logger.h"
 #include <cstring>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
 #include <iostream>
 #include <cassert>
+#include <atomic>
 
 using namespace std;
-#define TIMESLOT 5
+#define CONN_TIMEOUT 15000 // 新连接以及读取请求、发送响应过程中的超时时间，毫秒
+#define KEEPALIVE_TIMEOUT 60000 // 两个请求之间连接空闲的超时时间，毫秒
+#define LINGER_TIMEOUT 2000 // 不保持连接时，发送完响应之后等待客户端关闭连接的时间，毫秒
 
-class util_timer;
+class http_conn;
 class sort_timer_list;
+class timer_wheel;
+class conn_slab;
+
+// 定时器类
+class util_timer {
+public:
+    util_timer() :prev(NULL), next(NULL) {};
+    bool is_linked() {return prev != NULL;} // 是否在时间轮中
+    time_t expire; // 任务超时时间
+    void (*cb_func)(http_conn*); // 任务回调函数，回调函数处理的客户数量
+    http_conn *user_data;     // 用户数据
+    util_timer* prev;           // 前一个定时器
+    util_timer* next;           // 后一个定时器
+
+};
 
 class http_conn {
 
 public:
-    static const int READ_BUFFER_SIZE = 2048; //读缓冲区大小
-    static const int WRITE_BUFFER_SIZE = 2048; // 写缓冲区的大小
+    static const int READ_BUFFER_SIZE = 2048; // 读缓冲区的初始大小
+    static const int WRITE_BUFFER_SIZE = 2048; // 写缓冲区的初始大小
     static const int FILENAME_LEN = 200;
+    static const int MAX_PIPELINE = 16; // 一批最多处理的流水线请求数量，这些请求的响应合并在一起发送
 
     
-    http_conn() {};
+    http_conn() : m_sockfd(-1), m_read_buf(NULL), m_read_size(0), m_file(NULL),
+    m_write_buf(NULL), m_write_size(0), m_response_count(0), m_handle(0), m_slab(NULL), m_last_worker(-1) {};
     ~http_conn(){};
-    static int m_epollfd; // 所有socket上的事件都被注册到同一个epoll对象中
-    static int m_user_count; // 统计用户的数量
+    static std::atomic<int> m_user_count; // 统计用户的数量，多个reactor线程会同时修改
+    static int m_buffer_limit; // 读写缓冲区最多能增长到的大小，不超过buffer_pool::MAX_CHUNK_SIZE
+    static int m_request_timeout; // 默认为CONN_TIMEOUT
+    static int m_keepalive_timeout; // 默认为KEEPALIVE_TIMEOUT
+    static int m_linger_timeout; // 默认为LINGER_TIMEOUT
+    static int m_max_requests; // 一个连接最多处理的请求数量，达到之后响应中带上Connection: close，0表示不限制
+    static int m_write_quantum; // 每次可写事件最多发送的字节数，发送大文件的连接发完这么多之后让出事件循环
+    static int m_send_lowat; // 用sendfile发送大文件时socket发送队列中未发送数据的低水位(TCP_NOTSENT_LOWAT)
+    static const char * m_metrics_path; // 返回统计信息的URL，NULL表示不提供
+    static const char * m_root; // 资源目录，请求的URL直接贴在它后面
     
     // 状态的设置，以使用状态机
     enum METHOD 
@@ -85,6 +121,8 @@ public:
         FILE_REQUEST        :       文件请求，获取文件成功
         INTERNAL_ERROR      :       文件内部错误
         CLOSED_CONNECTION   :       表示客户端已经关闭连接
+        DEFERRED_REQUEST    :       请求完整，但响应不能在reactor线程中直接生成，需要交给线程池
+        METRICS_REQUEST     :       请求的是统计信息
     */
    /* 服务器的请求可能比这个多很多，这个只是列出了常用的一些code信息 */
     enum HTTP_CODE {
@@ -95,16 +133,49 @@ public:
         FORBIDDEN_REQUEST,
         FILE_REQUEST,
         INTERNAL_ERROR,
-        CLOSED_CONNECTION
+        CLOSED_CONNECTION,
+        DEFERRED_REQUEST,
+        METRICS_REQUEST
     };
 
     int getfd() {return m_sockfd;}
-    void init(int sockfd, const sockaddr_in & addr, sort_timer_list& timer_lst); // 初始化新接收的连接
+    int get_epollfd() {return m_epollfd;}
+    int get_sockfd() {return m_sockfd;}
+    // epoll事件中带回的句柄，由conn_slab分配
+    uint64_t get_handle() {return m_handle;}
+    // 初始化新接收的连接，连接注册到所属reactor的epoll对象和时间轮中，关闭之后槽归还给slab
+    void init(int sockfd, const sockaddr_in & addr, int epollfd, timer_wheel& timers, conn_slab& slab);
     void process(); // 处理客户端的请求
-    void close_conn();
-    bool read(int eppllfd, sort_timer_list& timer_lst);
+    // 在reactor线程中直接处理请求并发送响应，只用文件缓存中已经在内存里的小文件，不访问文件系统。
+    // 遇到其他请求时停下来返回false，由reactor交给线程池从这个请求继续处理
+    bool process_inline();
+    void close_conn(); // 只能在所属reactor线程中调用
+    bool read();
     bool write(); // 非阻塞的读和写
+
+    // io_uring后端使用的接口，epoll对象为-1时连接不注册epoll事件，由uring_reactor提交读写请求
+    bool append_data(const char * data, int len); // 追加内核已经收到的数据，相当于read()
+    bool has_response() {return m_response_count > 0;} // 还有没发送完的响应
+    bool has_pending_input() {return m_read_idx > m_checked_index;} // 读缓冲区中有还没解析的数据
+    bool sending_file(); // 接下来要发送的是sendfile发送的大文件内容
+    int prepare_send(struct iovec * iv, int & flags); // 填写接下来要用sendmsg发送的数据，返回iovec的数量
+    void complete_send(size_t sent); // 按发送的字节数推进进度，一批响应发送完时和write()一样决定是否保持连接
+    // 一批响应发送完之后，读缓冲区中还有因为达到MAX_PIPELINE而没有处理的请求，需要再交给线程池
+    bool has_buffered_request() {return m_pipeline_full && m_response_count == 0;}
+    // 交给线程池之前由reactor调用，之后定时器到期时不会关闭还在工作线程中的连接
+    void mark_dispatched();
+    // 把工作线程公布的超时时间更新到时间轮中，只能在所属reactor线程中调用。
+    // 定时器到期时也先调用它，连接还在工作线程中或者超时时间被推迟过则返回true，连接不关闭
+    bool sync_timer();
+    // 最后一个响应已经发送，正在等待客户端关闭连接，这期间收到的数据直接丢弃
+    bool is_closing() {return m_closing;}
     char * get_line() {return m_read_buf + m_start_line; }
+    // 上一次处理该连接的工作线程，work_stealing模式下请求优先投递给它
+    int get_last_worker() {return m_last_worker;}
+    void set_last_worker(int worker) {m_last_worker = worker;}
+    // 放入线程池队列的时间，用来统计排队的耗时
+    uint64_t get_enqueue_time() {return m_enqueue_time;}
+    void set_enqueue_time(uint64_t time) {m_enqueue_time = time;}
     HTTP_CODE do_request();
     
 private:
@@ -116,6 +187,7 @@ private:
     HTTP_CODE parse_content(char * text); // 解析HTTP请求体
     LINE_STATE parse_line(); // 解析一行
     void init(); // 初始化连接其余的信息
+    void init_request(); // 准备从m_checked_index开始解析下一个请求，不改变缓冲区
     bool add_response( const char* format, ... );
     bool add_content( const char* content );
     bool add_content_type();
@@ -124,15 +196,32 @@ private:
     bool add_content_length( int content_length );
     bool add_linger();
     bool add_blank_line();
-    void unmap();
+    void close_file();
+    // 读写缓冲区从buffer_pool中借用，空间不够时换成大一级的缓冲区，直到m_buffer_limit
+    bool grow_read_buf();
+    void move_read_data(char * buf); // 把当前请求开始的未处理数据移到buf的开头
+    bool advance(size_t sent); // 按发送的字节数推进发送进度，返回所有响应是否都已发送完
+    bool grow_write_buf(int size);
+    void release_buffers(); // 请求处理完之后归还缓冲区，空闲的连接不占用缓冲区
+    // 连接在ms毫秒之后超时。工作线程中只记下到期时间，交还连接时公布，由reactor调用sync_timer()更新时间轮
+    void set_timeout(int ms);
+    void rearm(int ev); // 重新注册EPOLLONESHOT事件，io_uring后端由uring_reactor根据连接的状态提交请求
+    void finish_batch(); // 一批响应发送完之后保持或者关闭连接
+    bool drain(); // 丢弃socket中的数据，客户端关闭连接时返回false
+    bool process_batch(); // 解析并响应一批流水线请求
+    void log_access(HTTP_CODE read_code); // 记录一条访问日志
 
 
     int m_sockfd; // 该http连接的socket；
+    int m_epollfd; // 该连接所属reactor的epoll对象
+    timer_wheel* m_timers; // 该连接所属reactor的时间轮
     char m_real_file[FILENAME_LEN];
     
     sockaddr_in m_address; // 通信的socket地址
-    char m_read_buf[READ_BUFFER_SIZE]; //读缓冲区的大小
+    char * m_read_buf; // 读缓冲区，没有未处理的数据时为NULL
+    int m_read_size; // 读缓冲区的大小
     int m_read_idx; // 读缓冲区中已经读入的客户端数据的最后一个字节的下标
+    int m_request_start; // 当前请求在读缓冲区中的起始位置，之前的请求已经处理完
     int m_checked_index; //当前正在分析的字符在缓冲区的位置
     int m_start_line; // 当前正在解析的行的起始位置
     int m_content_length;
@@ -141,35 +230,53 @@ private:
     char * m_version; // 协议版本HTTP1.1
     METHOD m_method;
     char * m_host;
-    bool m_linger; // HTTP请求是否要保持连接
-    struct stat m_file_stat;                // 目标文件的状态。通过它我们可以判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
-    char* m_file_address;                   // 客户请求的目标文件被mmap到内存中的起始位置
+    char * m_referer; // 只用于访问日志
+    char * m_user_agent; // 只用于访问日志
+    int m_accept_encoding; // 客户端接受的压缩编码，file_cache::GZIP、BROTLI的位掩码
+    long long m_body_length; // 响应体的长度，只用于访问日志
+    bool m_linger; // HTTP请求是否要保持连接，HTTP/1.1默认保持，HTTP/1.0默认不保持
+    int m_request_count; // 这个连接已经处理的请求数量
+    bool m_closing; // 已经关闭了写方向，等待客户端关闭连接
+    bool m_lowat_set; // 已经设置过TCP_NOTSENT_LOWAT
+    bool m_cache_only; // 正在reactor线程中处理，只能使用内存中的缓存项
+    bool m_deferred; // 当前请求已经解析完，等待工作线程调用do_request()
+    file_cache::entry* m_file;              // 客户请求的目标文件在文件缓存中的缓存项，包含文件的状态、内容或fd以及预先生成的响应头
 
     CHECK_STATE m_check_state;// 主状态机当前所属的状态
 
     
 
-    char m_write_buf[ WRITE_BUFFER_SIZE ];  // 写缓冲区
+    char * m_write_buf;                     // 写缓冲区，生成响应时才借用
+    int m_write_size;                       // 写缓冲区的大小
     int m_write_idx;                        // 写缓冲区中待发送的字节数
+    int m_write_sent;                       // 写缓冲区中已经发送的字节数
 
-    struct iovec m_iv[2];                   // 我们将采用writev来执行写操作，所以定义下面两个成员，其中m_iv_count表示被写内存块的数量。
-    int m_iv_count;
-    util_timer* timer;          // 定时器
+    // 等待发送的响应，响应头依次放在写缓冲区中，响应体是文件缓存项
+    struct response {
+        int header_end;                     // 响应头在写缓冲区中的结束位置
+        file_cache::entry * file;           // 响应体，错误响应没有
+        bool linger;                        // 发送完之后是否保持连接
+    };
+    response m_responses[MAX_PIPELINE];
+    int m_response_count;                   // 这一批的响应数量
+    int m_response_sent;                    // 已经发送完的响应数量
+    off_t m_file_offset;                    // 正在发送的响应体中已经发送到的位置，写到一半遇到EAGAIN时从这里继续
+    bool m_pipeline_full;                   // 这一批达到了MAX_PIPELINE，读缓冲区中可能还有完整的请求
+
+    util_timer m_timer;         // 定时器，嵌在连接对象中，不单独分配
+    std::atomic<time_t> m_deadline; // 工作线程交还连接时公布的到期时间，0表示还没有交还
+    time_t m_worker_deadline;   // 工作线程中set_timeout()设置的到期时间
+    bool m_dispatched;          // 已经交给线程池，reactor还没有取回工作线程公布的到期时间
+    uint64_t m_handle;          // 注册到epoll中的句柄，高32位是conn_slab中槽的代数
+    conn_slab* m_slab;          // 该连接所属reactor的连接对象池
+    friend class conn_slab;
+    friend class http_conn_bench; // bench/microbench.cpp直接在读缓冲区上驱动解析，不经过socket
+    int m_last_worker;          // 上一次处理该连接的工作线程
+    uint64_t m_enqueue_time;    // 放入线程池队列的时间(metrics::now())
 };
 
 
 
-// 定时器类
-class util_timer {
-public:
-    util_timer() :prev(NULL), next(NULL) {};
-    time_t expire; // 任务超时时间
-    void (*cb_func)(http_conn*); // 任务回调函数，回调函数处理的客户数量
-    http_conn *user_data;     // 用户数据
-    util_timer* prev;           // 前一个定时器
-    util_timer* next;           // 后一个定时器
-
-};
 
 
 
@@ -271,7 +378,6 @@ public:
         if ( !head ) {
             return;
         }
-        printf( "timer tick\n" );
         time_t cur = time( NULL ); // 获取当前时间
         util_timer* temp = head;
         while (temp) {
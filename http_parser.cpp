@@ -0,0 +1,155 @@
+#include "http_parser.h"
+#include <string.h>
+#include <strings.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_PARSER_X86
+#endif
+
+static const char * find_char2_scalar(const char * p, const char * end, char c1, char c2)
+{
+    for ( ; p < end; ++ p) {
+        if (*p == c1 || *p == c2) {
+            return p;
+        }
+    }
+    return end;
+}
+
+#ifdef HTTP_PARSER_X86
+// 两个字符的集合用比较+movemask比SSE4.2的PCMPESTRI更快，16字节的版本只需要SSE2
+__attribute__((target("sse2")))
+static const char * find_char2_sse(const char * p, const char * end, char c1, char c2)
+{
+    const __m128i v1 = _mm_set1_epi8(c1);
+    const __m128i v2 = _mm_set1_epi8(c2);
+    for ( ; end - p >= 16; p += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, v1), _mm_cmpeq_epi8(chunk, v2)));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return find_char2_scalar(p, end, c1, c2);
+}
+
+__attribute__((target("avx2")))
+static const char * find_char2_avx2(const char * p, const char * end, char c1, char c2)
+{
+    const __m256i v1 = _mm256_set1_epi8(c1);
+    const __m256i v2 = _mm256_set1_epi8(c2);
+    for ( ; end - p >= 32; p += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, v1), _mm256_cmpeq_epi8(chunk, v2)));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    // 剩下的部分也在这里处理，不能直接调用find_char2_sse：从AVX代码跳到非VEX编码的SSE代码时
+    // ymm寄存器的高位没有清零，之后所有的SSE指令(包括glibc中的字符串函数)都会变慢
+    if (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm256_castsi256_si128(v1)),
+                                                  _mm_cmpeq_epi8(chunk, _mm256_castsi256_si128(v2))));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return find_char2_scalar(p, end, c1, c2);
+}
+
+// 在静态初始化阶段检测，需要先调用__builtin_cpu_init
+static bool detect_avx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+static const bool has_avx2 = detect_avx2();
+#endif
+
+const char * find_char2(const char * p, const char * end, char c1, char c2)
+{
+#ifdef HTTP_PARSER_X86
+    if (has_avx2) {
+        return find_char2_avx2(p, end, c1, c2);
+    }
+    return find_char2_sse(p, end, c1, c2);
+#else
+    return find_char2_scalar(p, end, c1, c2);
+#endif
+}
+
+// 完美哈希：由字段名的长度、首字母和尾字母计算，下面的字段在64个槽中没有冲突，
+// 增加字段时需要重新选择系数，保证仍然没有冲突
+static const int HEADER_TABLE_SIZE = 64;
+
+static inline unsigned header_hash(const char * name, int len)
+{
+    // 字段名的首尾都是字母，| 0x20 转成小写
+    return ((name[0] | 0x20) + (name[len - 1] | 0x20) * 4 + len * 9) & (HEADER_TABLE_SIZE - 1);
+}
+
+struct header_name {
+    const char * name;
+    int len;
+    HEADER_FIELD field;
+};
+
+static const header_name known_headers[] = {
+    { "Host", 4, HEADER_HOST },
+    { "Connection", 10, HEADER_CONNECTION },
+    { "Content-Length", 14, HEADER_CONTENT_LENGTH },
+    { "Content-Type", 12, HEADER_CONTENT_TYPE },
+    { "Accept", 6, HEADER_ACCEPT },
+    { "Accept-Encoding", 15, HEADER_ACCEPT_ENCODING },
+    { "Accept-Language", 15, HEADER_ACCEPT_LANGUAGE },
+    { "User-Agent", 10, HEADER_USER_AGENT },
+    { "Cache-Control", 13, HEADER_CACHE_CONTROL },
+    { "Upgrade-Insecure-Requests", 25, HEADER_UPGRADE_INSECURE_REQUESTS },
+    { "Cookie", 6, HEADER_COOKIE },
+    { "Referer", 7, HEADER_REFERER },
+    { "If-Modified-Since", 17, HEADER_IF_MODIFIED_SINCE },
+    { "If-None-Match", 13, HEADER_IF_NONE_MATCH },
+    { "Keep-Alive", 10, HEADER_KEEP_ALIVE },
+    { "Transfer-Encoding", 17, HEADER_TRANSFER_ENCODING },
+    { "Pragma", 6, HEADER_PRAGMA },
+    { "Range", 5, HEADER_RANGE },
+    { "Origin", 6, HEADER_ORIGIN },
+    { "Expect", 6, HEADER_EXPECT },
+    { "Authorization", 13, HEADER_AUTHORIZATION },
+    { "If-Range", 8, HEADER_IF_RANGE },
+    { "DNT", 3, HEADER_DNT },
+};
+
+// 哈希表在程序启动时由known_headers生成，空槽的len为0
+static header_name header_table[HEADER_TABLE_SIZE];
+
+static bool build_header_table()
+{
+    for (size_t i = 0; i < sizeof(known_headers) / sizeof(known_headers[0]); ++ i) {
+        const header_name & h = known_headers[i];
+        header_name & slot = header_table[header_hash(h.name, h.len)];
+        if (slot.len != 0) {
+            return false; // 出现冲突，需要重新选择哈希系数
+        }
+        slot = h;
+    }
+    return true;
+}
+
+static const bool header_table_ready __attribute__((unused)) = build_header_table();
+
+HEADER_FIELD lookup_header(const char * name, int len)
+{
+    if (len <= 0) {
+        return HEADER_UNKNOWN;
+    }
+    const header_name & slot = header_table[header_hash(name, len)];
+    if (slot.len == len && strncasecmp(slot.name, name, len) == 0) {
+        return slot.field;
+    }
+    return HEADER_UNKNOWN;
+}
@@ -0,0 +1,42 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+// HTTP/1.x请求解析用到的扫描函数。
+// 查找行尾和头部字段的冒号时每次比较16(SSE2)或32(AVX2)个字节，运行时根据CPU选择，
+// 不是x86的平台以及最后不足16字节的部分逐字节比较。
+
+// 返回[p, end)中第一个等于c1或c2的字符的位置，没有时返回end
+const char * find_char2(const char * p, const char * end, char c1, char c2);
+
+// 已知的头部字段，通过完美哈希查找，每个字段名最多比较一次
+enum HEADER_FIELD {
+    HEADER_UNKNOWN = 0,
+    HEADER_HOST,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_LENGTH,
+    HEADER_CONTENT_TYPE,
+    HEADER_ACCEPT,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_ACCEPT_LANGUAGE,
+    HEADER_USER_AGENT,
+    HEADER_CACHE_CONTROL,
+    HEADER_UPGRADE_INSECURE_REQUESTS,
+    HEADER_COOKIE,
+    HEADER_REFERER,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_IF_NONE_MATCH,
+    HEADER_KEEP_ALIVE,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_PRAGMA,
+    HEADER_RANGE,
+    HEADER_ORIGIN,
+    HEADER_EXPECT,
+    HEADER_AUTHORIZATION,
+    HEADER_IF_RANGE,
+    HEADER_DNT
+};
+
+// 根据字段名(不区分大小写，不包括冒号)查找头部字段，不认识的字段返回HEADER_UNKNOWN
+HEADER_FIELD lookup_header(const char * name, int len);
+
+#endif
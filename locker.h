@@ -3,6 +3,10 @@
 #include <pthread.h>
 #include <exception>
 #include <semaphore.h>
+#include <atomic>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 // 线程同步机制封装类
 
 // 互斥锁类
@@ -97,4 +101,50 @@ private:
 
 
 
-#endif
\ No newline at end of file
+// 基于futex的事件计数，用来让无锁队列的消费者在没有数据时睡眠。
+// 消费者先prepare_wait()，再检查一次条件，条件仍不满足时wait()，否则cancel_wait()；
+// 生产者修改数据之后调用notify，只有确实有线程在等待时才会进入内核
+class event_count {
+public:
+    event_count() : m_seq(0), m_waiters(0) {}
+
+    unsigned prepare_wait() {
+        m_waiters.fetch_add(1);
+        return m_seq.load();
+    }
+    void cancel_wait() {
+        m_waiters.fetch_sub(1);
+    }
+    // prepare_wait()之后有notify时立即返回
+    void wait(unsigned key) {
+        syscall(SYS_futex, (int *)&m_seq, FUTEX_WAIT_PRIVATE, key, NULL, NULL, 0);
+        m_waiters.fetch_sub(1);
+    }
+    // 同wait()，最多等待ms毫秒
+    void wait_for(unsigned key, int ms) {
+        struct timespec timeout = { ms / 1000, (ms % 1000) * 1000000L };
+        syscall(SYS_futex, (int *)&m_seq, FUTEX_WAIT_PRIVATE, key, &timeout, NULL, 0);
+        m_waiters.fetch_sub(1);
+    }
+    void notify_one() {
+        notify(1);
+    }
+    void notify_all() {
+        notify(0x7fffffff);
+    }
+
+private:
+    void notify(int count) {
+        // 保证生产者写入的数据在读取m_waiters之前对消费者可见
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiters.load() > 0) {
+            m_seq.fetch_add(1);
+            syscall(SYS_futex, (int *)&m_seq, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+        }
+    }
+
+    std::atomic<unsigned> m_seq;
+    std::atomic<int> m_waiters;
+};
+
+#endif
@@ -0,0 +1,343 @@
+#include "logger.h"
+#include "locker.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <vector>
+
+static const int LINE_SIZE = 1024;              // 一行日志的最大长度，超过时截断
+static const uint32_t LOG_RING_SIZE = 64 * 1024;        // 每个线程运行日志的缓冲区大小，必须是2的幂
+static const uint32_t ACCESS_RING_SIZE = 256 * 1024;    // 每个线程访问日志的缓冲区大小，必须是2的幂
+static const int FLUSH_INTERVAL = 100;          // 后台线程最多每隔多少毫秒写一次文件
+
+// 单生产者单消费者的字节环形缓冲区，只放完整的行，后台线程可以直接把[head, tail)写入文件。
+// head和tail只增不减，取模之后才是下标，分开放在两个缓存行中
+struct log_ring {
+    char * buf;
+    uint32_t size;
+    int fd;
+    alignas(64) std::atomic<uint32_t> tail;     // 写日志的线程修改
+    std::atomic<uint64_t> dropped;              // 缓冲区满时丢弃的行数
+    alignas(64) std::atomic<uint32_t> head;     // 后台线程修改
+};
+
+std::atomic<int> logger::m_level(logger::INFO);
+std::atomic<bool> logger::m_access_enabled(false);
+
+static int log_fd = STDOUT_FILENO;
+static int access_fd = -1;
+static std::vector<log_ring *> rings;           // 所有线程的缓冲区，线程退出之后仍然保留
+static locker rings_locker;
+static event_count flush_event;                 // 缓冲区超过一半时提前唤醒后台线程
+static pthread_t flusher;
+static std::atomic<bool> running(false);
+static std::atomic<bool> stopping(false);
+
+static thread_local log_ring * local_log = NULL;
+static thread_local log_ring * local_access = NULL;
+
+static const char * level_names[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+static log_ring * new_ring(uint32_t size, int fd)
+{
+    log_ring * r = new log_ring;
+    r->buf = new char[size];
+    r->size = size;
+    r->fd = fd;
+    r->tail = 0;
+    r->dropped = 0;
+    r->head = 0;
+    rings_locker.lock();
+    rings.push_back(r);
+    rings_locker.unlock();
+    return r;
+}
+
+// 把一行放进缓冲区，空间不够时丢弃
+static void push(log_ring * r, const char * line, uint32_t len)
+{
+    uint32_t tail = r->tail.load(std::memory_order_relaxed);
+    uint32_t head = r->head.load(std::memory_order_acquire);
+    uint32_t used = tail - head;
+    if (len > r->size - used) {
+        r->dropped.store(r->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+    uint32_t pos = tail & (r->size - 1);
+    uint32_t first = r->size - pos < len ? r->size - pos : len;
+    memcpy(r->buf + pos, line, first);
+    memcpy(r->buf, line + first, len - first);
+    r->tail.store(tail + len, std::memory_order_release);
+    if (used < r->size / 2 && used + len >= r->size / 2) {
+        flush_event.notify_one(); // 写得很快，不等下一个周期
+    }
+}
+
+static void write_all(int fd, struct iovec * iv, int count)
+{
+    while (count > 0) {
+        ssize_t n = writev(fd, iv, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return; // 磁盘满等错误时放弃这一批
+        }
+        while (count > 0 && (size_t)n >= iv->iov_len) {
+            n -= iv->iov_len;
+            ++ iv;
+            -- count;
+        }
+        if (count > 0) {
+            iv->iov_base = (char *)iv->iov_base + n;
+            iv->iov_len -= n;
+        }
+    }
+}
+
+// 把所有缓冲区中已有的内容按目标文件分别用writev写出
+static void flush_rings()
+{
+    rings_locker.lock();
+    std::vector<log_ring *> snapshot(rings);
+    rings_locker.unlock();
+    int fds[2] = { log_fd, access_fd };
+    for (int k = 0; k < 2; ++ k) {
+        if (fds[k] == -1) {
+            continue;
+        }
+        std::vector<struct iovec> iv;
+        std::vector<uint32_t> tails(snapshot.size());
+        uint64_t dropped = 0;
+        for (size_t i = 0; i < snapshot.size(); ++ i) {
+            log_ring * r = snapshot[i];
+            if (r->fd != fds[k]) {
+                continue;
+            }
+            uint32_t head = r->head.load(std::memory_order_relaxed);
+            uint32_t tail = r->tail.load(std::memory_order_acquire);
+            tails[i] = tail;
+            dropped += r->dropped.exchange(0, std::memory_order_relaxed);
+            uint32_t pos = head & (r->size - 1);
+            uint32_t len = tail - head;
+            if (len == 0) {
+                continue;
+            }
+            uint32_t first = r->size - pos < len ? r->size - pos : len;
+            struct iovec v = { r->buf + pos, first };
+            iv.push_back(v);
+            if (len > first) {
+                struct iovec w = { r->buf, len - first };
+                iv.push_back(w);
+            }
+        }
+        char note[128];
+        if (dropped) {
+            struct iovec v = { note, (size_t)snprintf(note, sizeof(note), "[WARN] %llu log lines dropped, log buffer full\n",
+                (unsigned long long)dropped) };
+            iv.push_back(v);
+        }
+        for (size_t i = 0; i < iv.size(); i += IOV_MAX) {
+            write_all(fds[k], &iv[i], iv.size() - i < IOV_MAX ? iv.size() - i : IOV_MAX);
+        }
+        // 写完之后才归还空间
+        for (size_t i = 0; i < snapshot.size(); ++ i) {
+            if (snapshot[i]->fd == fds[k]) {
+                snapshot[i]->head.store(tails[i], std::memory_order_release);
+            }
+        }
+    }
+}
+
+static void * flush_loop(void *)
+{
+    while (true) {
+        bool last = stopping.load();
+        flush_rings();
+        if (last) {
+            break;
+        }
+        unsigned key = flush_event.prepare_wait();
+        if (stopping.load()) {
+            flush_event.cancel_wait();
+            continue;
+        }
+        flush_event.wait_for(key, FLUSH_INTERVAL);
+    }
+    return NULL;
+}
+
+static int open_log(const char * path)
+{
+    return open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+}
+
+bool logger::init(const char * path, const char * access_path, int level)
+{
+    set_level(level);
+    if (path) {
+        log_fd = open_log(path);
+        if (log_fd < 0) {
+            log_fd = STDOUT_FILENO;
+            return false;
+        }
+    }
+    if (access_path) {
+        access_fd = open_log(access_path);
+        if (access_fd < 0) {
+            return false;
+        }
+        m_access_enabled.store(true, std::memory_order_relaxed);
+    }
+    if (pthread_create(&flusher, NULL, flush_loop, NULL) != 0) {
+        return false;
+    }
+    running = true;
+    return true;
+}
+
+void logger::stop()
+{
+    if (!running.exchange(false)) {
+        return;
+    }
+    m_access_enabled.store(false, std::memory_order_relaxed);
+    stopping = true;
+    flush_event.notify_all();
+    pthread_join(flusher, NULL);
+    if (log_fd != STDOUT_FILENO) {
+        close(log_fd);
+        log_fd = STDOUT_FILENO;
+    }
+    if (access_fd != -1) {
+        close(access_fd);
+        access_fd = -1;
+    }
+}
+
+int logger::parse_level(const char * name)
+{
+    for (int i = DEBUG; i <= ERROR; ++ i) {
+        if (strcasecmp(name, level_names[i]) == 0) {
+            return i;
+        }
+    }
+    return strcasecmp(name, "off") == 0 ? OFF : -1;
+}
+
+void logger::set_level(int level)
+{
+    if (level < DEBUG) {
+        level = DEBUG;
+    } else if (level > OFF) {
+        level = OFF;
+    }
+    m_level.store(level, std::memory_order_relaxed);
+}
+
+// 每个线程缓存当前这一秒格式化好的时间，同一秒内的日志不需要再调用localtime_r/strftime
+struct time_cache {
+    time_t sec;
+    char text[64];
+    int len;
+};
+
+static const char * format_time(time_cache & cache, time_t sec, const char * format, int & len)
+{
+    if (cache.sec != sec || cache.len == 0) {
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        cache.len = strftime(cache.text, sizeof(cache.text), format, &tm);
+        cache.sec = sec;
+    }
+    len = cache.len;
+    return cache.text;
+}
+
+void logger::write(int level, const char * format, ...)
+{
+    static thread_local time_cache cache;
+    char line[LINE_SIZE];
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    int len;
+    const char * now = format_time(cache, ts.tv_sec, "%Y-%m-%d %H:%M:%S", len);
+    int n = snprintf(line, sizeof(line), "%.*s.%03ld [%s] ", len, now, ts.tv_nsec / 1000000,
+        level_names[level < ERROR ? level : ERROR]);
+    va_list args;
+    va_start(args, format);
+    int m = vsnprintf(line + n, sizeof(line) - n - 1, format, args);
+    va_end(args);
+    n += m < (int)sizeof(line) - n - 1 ? m : (int)sizeof(line) - n - 2;
+    line[n++] = '\n';
+    if (!running.load(std::memory_order_relaxed)) {
+        // 还没有启动或者已经结束，直接写到标准错误
+        ::write(STDERR_FILENO, line, n);
+        return;
+    }
+    if (!local_log) {
+        local_log = new_ring(LOG_RING_SIZE, log_fd);
+    }
+    push(local_log, line, n);
+}
+
+// 和nginx一样把客户端发来的字段中的"、\、控制字符和非ASCII字节写成\xHH，
+// 避免伪造或者截断日志行。结果不超过size - 1个字节，放不下时截断，不会拆开一个转义序列
+static const char * escape(const char * s, char * buf, size_t size)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    size_t n = 0;
+    for (; *s; ++ s) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\' || c < 0x20 || c >= 0x7f) {
+            if (n + 4 >= size) {
+                break;
+            }
+            buf[n++] = '\\';
+            buf[n++] = 'x';
+            buf[n++] = hex[c >> 4];
+            buf[n++] = hex[c & 0xf];
+        } else {
+            if (n + 1 >= size) {
+                break;
+            }
+            buf[n++] = c;
+        }
+    }
+    buf[n] = '\0';
+    return buf;
+}
+
+void logger::access(const char * addr, const char * method, const char * url, const char * version,
+                    int status, long long bytes, const char * referer, const char * user_agent)
+{
+    if (!m_access_enabled.load(std::memory_order_relaxed)) {
+        return;
+    }
+    static thread_local time_cache cache;
+    char line[LINE_SIZE];
+    char url_buf[LINE_SIZE], referer_buf[LINE_SIZE], user_agent_buf[LINE_SIZE];
+    int len;
+    const char * now = format_time(cache, time(NULL), "%d/%b/%Y:%H:%M:%S %z", len);
+    // 请求行无法解析时整个请求记为"-"
+    int n = snprintf(line, sizeof(line) - 1, "%s - - [%.*s] \"%s%s%s%s%s\" %d %lld \"%s\" \"%s\"",
+        addr, len, now, url ? method : "-", url ? " " : "", url ? escape(url, url_buf, sizeof(url_buf)) : "",
+        url ? " " : "", url ? version : "", status, bytes,
+        referer ? escape(referer, referer_buf, sizeof(referer_buf)) : "-",
+        user_agent ? escape(user_agent, user_agent_buf, sizeof(user_agent_buf)) : "-");
+    if (n >= (int)sizeof(line) - 1) {
+        n = sizeof(line) - 2;
+    }
+    line[n++] = '\n';
+    if (!local_access) {
+        local_access = new_ring(ACCESS_RING_SIZE, access_fd);
+    }
+    push(local_access, line, n);
+}
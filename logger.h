@@ -0,0 +1,46 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+
+// 异步日志：运行日志和访问日志。每个线程第一次写日志时分配自己的环形缓冲区(单生产者单消费者，无锁)，
+// 写日志的线程只把格式化好的一行复制进去，由后台线程定期把所有缓冲区中的内容批量写入文件；
+// 缓冲区满时丢弃这一行并计数，不会阻塞请求的处理。
+// 运行日志按级别过滤，低于当前级别的LOG_xxx只比较一次级别，不会格式化，也不会调用stdio。
+class logger {
+public:
+    enum level {
+        DEBUG = 0,
+        INFO,
+        WARN,
+        ERROR,
+        OFF
+    };
+
+    // path为NULL时运行日志写到标准输出；access_path为NULL时不记录访问日志。打开文件失败时返回false
+    static bool init(const char * path, const char * access_path, int level);
+    static void stop(); // 写出剩下的日志并结束后台线程，之后的日志直接写到标准错误
+    static int parse_level(const char * name); // debug、info、warn、error、off，无法识别时返回-1
+
+    static int get_level() {return m_level.load(std::memory_order_relaxed);}
+    static void set_level(int level);
+    static bool access_enabled() {return m_access_enabled.load(std::memory_order_relaxed);}
+
+    static void write(int level, const char * format, ...) __attribute__((format(printf, 2, 3)));
+    // 访问日志，combined格式：
+    // 客户端地址 - - [时间] "请求行" 状态码 响应体字节数 "Referer" "User-Agent"
+    // url为NULL表示请求行无法解析，referer和user_agent为NULL时记为"-"
+    static void access(const char * addr, const char * method, const char * url, const char * version,
+                       int status, long long bytes, const char * referer, const char * user_agent);
+
+private:
+    static std::atomic<int> m_level;
+    static std::atomic<bool> m_access_enabled; // stop()清除时工作线程可能正在读取
+};
+
+#define LOG_DEBUG(format, ...) do { if (logger::get_level() <= logger::DEBUG) logger::write(logger::DEBUG, format, ##__VA_ARGS__); } while (0)
+#define LOG_INFO(format, ...) do { if (logger::get_level() <= logger::INFO) logger::write(logger::INFO, format, ##__VA_ARGS__); } while (0)
+#define LOG_WARN(format, ...) do { if (logger::get_level() <= logger::WARN) logger::write(logger::WARN, format, ##__VA_ARGS__); } while (0)
+#define LOG_ERROR(format, ...) do { if (logger::get_level() <= logger::ERROR) logger::write(logger::ERROR, format, ##__VA_ARGS__); } while (0)
+
+#endif
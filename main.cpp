@@ -12,14 +12,16 @@
 #include "threadpool.h"
 #include <signal.h>
 #include "http_conn.h"
+#include "reactor.h"
+#include "uring_reactor.h"
+#include "logger.h"
+#include "config.h"
 #include <cassert>
+#include <vector>
+#include <libgen.h>
 
 
-#define MAX_FD 65535    // 最大的fd数量
-#define MAX_EVENT_NUMBER 10000 // 一次监听的最大事件数目
-
 int pipefd[2];
-sort_timer_list timer_lst;
 int epollfd;
 
 void addsig(int sig, void ( handler )(int))
@@ -28,7 +30,9 @@ void addsig(int sig, void ( handler )(int))
     memset( &sa, '\0', sizeof( sa ) );
     sa.sa_handler = handler;
     sigfillset( &sa.sa_mask );
-    assert( sigaction( sig, &sa, NULL ) != -1 );
+    int ret = sigaction( sig, &sa, NULL ); // 不能放在assert中，定义NDEBUG时不会执行
+    assert( ret != -1 );
+    (void)ret;
 }
 
 void sig_handler( int sig )
@@ -39,7 +43,8 @@ void sig_handler( int sig )
     errno = save_errno;
 }
 
-// 重载函数，提供定时检测非活使用
+// 重载函数，信号通过管道交给主循环处理：SIGTERM结束服务器，SIGUSR1/SIGUSR2调低/调高日志级别，
+// 定时器由各reactor的timerfd驱动
 void addsig( int sig )
 {
     struct sigaction sa;
@@ -47,16 +52,12 @@ void addsig( int sig )
     sa.sa_handler = sig_handler;
     sa.sa_flags |= SA_RESTART;
     sigfillset( &sa.sa_mask );
-    assert( sigaction( sig, &sa, NULL ) != -1 );
+    int ret = sigaction( sig, &sa, NULL ); // 不能放在assert中，定义NDEBUG时不会执行
+    assert( ret != -1 );
+    (void)ret;
 }
 
-void timer_handler()
-{
-    // 定时处理任务，实际上就是调用tick()函数
-    timer_lst.tick();
-    // 因为一次 alarm 调用只会引起一次SIGALARM 信号，所以我们要重新定时，以不断触发 SIGALARM信号。
-    alarm(TIMESLOT);
-}
+
 
 
 
@@ -64,38 +65,121 @@ void timer_handler()
 extern int setnonblocking(int fd);
 
 // 添加文件描述符到epoll中
-extern void addfd(int epollfd, int fd, bool oneshot);
+extern void addfd(int epollfd, int fd, bool oneshot, uint64_t data);
 
 // 从epoll中删除文件描述符
 extern void removefd(int epollfd, int fd);
 
 // 修改文件描述符
-extern void modfd(int epollfd, int fd, int ev);
+extern void modfd(int epollfd, int fd, int ev, uint64_t data);
 
 int main(int argc, char * argv[])
 {
+    // -f 配置文件，其余选项覆盖配置文件中的同名项(括号中是配置项的名字，完整的列表见webserver.conf)：
+    // -r 指定子reactor的数量(reactors)，为0时使用单reactor模式，所有IO都在主线程中完成
+    // -s 分片监听模式(reuseport)，每个子reactor打开自己的SO_REUSEPORT监听socket并各自accept
+    // -b 指定监听队列长度(backlog)
+    // -t 指定线程池的线程数量(threads)，-w 开启work stealing模式(work_stealing)，
+    //    -c 指定工作线程绑定的CPU列表(cpus)，如 0,2,4
+    // -k 指定keep-alive连接的空闲超时时间(keepalive_timeout，毫秒)，-n 指定每个连接最多处理的请求数量(max_requests，0表示不限制)
+    // -u 使用io_uring后端(uring)，请求在reactor线程中处理，不使用线程池；-r为0时也启动一个reactor线程，
+    //    不加-s时所有reactor在主线程创建的监听socket上accept。内核不支持时退回epoll
+    // -i epoll后端中命中缓存的小文件请求直接在reactor线程中处理(inline)，线程池只处理需要读文件的请求
+    // -m 指定返回统计信息(Prometheus文本格式)的URL(metrics_path)，如 /metrics，不指定时不提供
+    // -l 日志级别(log_level) debug/info/warn/error/off，默认info；-L 运行日志文件(log_file)，默认写到标准输出；
+    // -a 访问日志文件(access_log，combined格式)，不指定时不记录
+    // -d 资源目录(root)，-o key=value 设置任意一项配置；端口号(port)可以省略，由配置文件指定
+    static const struct {
+        char opt;
+        const char * key;
+    } short_options[] = {
+        { 'r', "reactors" }, { 'b', "backlog" }, { 't', "threads" }, { 'c', "cpus" },
+        { 'k', "keepalive_timeout" }, { 'n', "max_requests" }, { 'm', "metrics_path" },
+        { 'l', "log_level" }, { 'L', "log_file" }, { 'a', "access_log" }, { 'd', "root" },
+        { 's', "reuseport" }, { 'w', "work_stealing" }, { 'u', "uring" }, { 'i', "inline" }
+    };
+    const char * config_path = NULL;
+    // 命令行上的选项按顺序记下来，读取配置文件之后再应用
+    std::vector<std::pair<std::string, std::string> > overrides;
+    bool usage = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "f:o:r:sb:t:wc:k:n:uim:l:L:a:d:")) != -1) {
+        if (opt == 'f') {
+            config_path = optarg;
+            continue;
+        }
+        if (opt == 'o') {
+            const char * eq = strchr(optarg, '=');
+            if (!eq) {
+                usage = true;
+                continue;
+            }
+            overrides.push_back(std::make_pair(std::string(optarg, eq - optarg), std::string(eq + 1)));
+            continue;
+        }
+        size_t i = 0;
+        while (i < sizeof(short_options) / sizeof(short_options[0]) && short_options[i].opt != opt) {
+            ++ i;
+        }
+        if (i == sizeof(short_options) / sizeof(short_options[0])) {
+            usage = true;
+            continue;
+        }
+        // 不带参数的选项是开关
+        overrides.push_back(std::make_pair(std::string(short_options[i].key), std::string(optarg ? optarg : "on")));
+    }
+    if (optind < argc) {
+        overrides.push_back(std::make_pair(std::string("port"), std::string(argv[optind])));
+    }
 
-    // 使用命令行指定端口等信息
-    if (argc <= 1) {
+    config conf;
+    if (!usage && config_path && !conf.load(config_path)) {
+        exit(-1);
+    }
+    for (size_t i = 0; !usage && i < overrides.size(); ++ i) {
+        usage = !conf.set(overrides[i].first.c_str(), overrides[i].second.c_str());
+    }
+    if (usage || !conf.check()) {
 
-        printf("按照如下格式运行: %s port_number\n", basename(argv[0]));
+        printf("按照如下格式运行: %s [-f config_file] [-o key=value] [-r reactor_number [-s]] [-b backlog] [-t thread_number [-w] [-c cpu_list]] [-k keepalive_ms] [-n max_requests] [-u] [-i] [-m metrics_path] [-l log_level] [-L log_file] [-a access_log] [-d root] [port_number]\n", basename(argv[0]));
 
         exit(-1);
 
     }
-
-    // 获取端口号
-    int port = atoi(argv[1]);
+    conf.apply();
+    int port = conf.port;
+    int reactor_number = conf.reactors;
+    bool reuseport = conf.reuseport;
+    bool use_uring = conf.uring;
+    int backlog = conf.backlog;
+
+    if (!logger::init(conf.log_file.empty() ? NULL : conf.log_file.c_str(),
+                      conf.access_log.empty() ? NULL : conf.access_log.c_str(), conf.log_level)) {
+        printf("open log file failed, errno is: %d\n", errno);
+        exit(-1);
+    }
+    if (config_path) {
+        LOG_INFO("config file %s", config_path);
+    }
+    conf.dump();
+    metrics::init();
 
     // 对sigpie信号进行处理
     addsig(SIGPIPE, SIG_IGN); // 对信号进行忽略
 
+    if (use_uring && !uring_reactor::supported()) {
+        LOG_WARN("io_uring is not supported, use epoll");
+        use_uring = false;
+    }
+
     // 创建线程池，初始化信息
     threadpool<http_conn> * pool = NULL;
 
     try {
 
-        pool = new threadpool<http_conn>;
+        if (!use_uring) {
+            pool = new threadpool<http_conn>(conf.threads, conf.queue_depth, conf.work_stealing, conf.cpus);
+        }
 
     } catch(...) {
 
@@ -103,96 +187,107 @@ int main(int argc, char * argv[])
 
     }
 
-    // 使用数组保存所有的客户端信息
-    http_conn * requestArr = new http_conn[MAX_FD];
-
-    // 网络部分的代码
-    int listenfd =socket(AF_INET, SOCK_STREAM, 0);
-
-    
-    
-
-    // 绑定端口
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(port);
-
-    // 设置端口复用
-    int reuse = 1;
-    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-    int ret = bind(listenfd, (struct sockaddr *) &addr, sizeof(addr));
-
-    ret = listen(listenfd, 128);
-
-
+    // 网络部分的代码，分片监听模式下主线程不需要监听socket
+    int listenfd = -1;
+    if (!reuseport) {
+        listenfd = create_listenfd(port, backlog, false);
+        if (listenfd < 0) {
+            LOG_ERROR("listen on port %d failed, errno is: %d", port, errno);
+            exit(-1);
+        }
+    }
 
     // 创建epoll,事件数组，存储epoll的存储事件的对象，相比于前面两个来说，已经好了很多了
-    epoll_event events[MAX_EVENT_NUMBER];
+    epoll_event * events = new epoll_event[reactor::m_max_events];
 
-    // 开辟epollevent区域，包含了红黑树的所有事件，以及链表的有修改的部分
-    epollfd = epoll_create(200);
+    // 单reactor模式下主线程本身就是唯一的reactor，监听socket和连接注册在同一个epoll对象中；
+    // 多reactor模式下主线程只负责accept，连接按轮询的方式分发给各个子reactor
+    reactor * main_reactor = NULL;
+    std::vector<reactor *> sub_reactors;
+    std::vector<uring_reactor *> uring_reactors;
+    try {
+        if (use_uring) {
+            // io_uring后端的reactor各自accept，主线程只处理信号
+            for (int i = 0; i < (reactor_number > 0 ? reactor_number : 1); ++ i) {
+                uring_reactors.push_back(new uring_reactor());
+                if (!reuseport) {
+                    uring_reactors.back()->share_listenfd(listenfd);
+                } else if (!uring_reactors.back()->listen_on(port, backlog)) {
+                    LOG_ERROR("listen on port %d failed, errno is: %d", port, errno);
+                    throw std::exception();
+                }
+                if (!uring_reactors.back()->start()) {
+                    throw std::exception();
+                }
+            }
+            epollfd = epoll_create(200);
+        } else if (reactor_number == 0) {
+            main_reactor = new reactor(pool, conf.inline_requests);
+            epollfd = main_reactor->get_epollfd();
+        } else {
+            for (int i = 0; i < reactor_number; ++ i) {
+                sub_reactors.push_back(new reactor(pool, conf.inline_requests));
+                if (reuseport && !sub_reactors.back()->listen_on(port, backlog)) {
+                    LOG_ERROR("listen on port %d failed, errno is: %d", port, errno);
+                    throw std::exception();
+                }
+                if (!sub_reactors.back()->start()) {
+                    throw std::exception();
+                }
+            }
+            // 开辟epollevent区域，包含了红黑树的所有事件，以及链表的有修改的部分
+            epollfd = epoll_create(200);
+        }
+    } catch(...) {
+        exit(-1);
+    }
+    size_t next_reactor = 0;
     // 将监听的文件描述符添加到epoll对象中 // 注册读就绪事件
-    addfd(epollfd, listenfd, false);
+    if (listenfd != -1 && !use_uring) {
+        addfd(epollfd, listenfd, false, listenfd);
+    }
 
     // 创建管道
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0 ,pipefd);
+    int ret = socketpair(PF_UNIX, SOCK_STREAM, 0 ,pipefd);
     assert( ret != -1 );
     setnonblocking(pipefd[1]);
-    addfd(epollfd, pipefd[0], true);
+    setnonblocking(pipefd[0]);
+    addfd(epollfd, pipefd[0], false, pipefd[0]);
 
-    // 添加两种信号
-    addsig( SIGALRM );
     addsig( SIGTERM );
+    addsig( SIGUSR1 );
+    addsig( SIGUSR2 );
     bool stop_server = false;
 
-    bool timeout = false;
-    alarm(TIMESLOT);  // 定时,5秒后产生SIGALARM信号
-
-    http_conn::m_epollfd = epollfd;
     while (! stop_server)
     {
         // 主线程不断循环检测事件的发生
-        int num = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
+        int num = epoll_wait(epollfd, events, reactor::m_max_events, -1);
         if (num < 0 && errno != EINTR) {
-            printf("epoll failure");
+            LOG_ERROR("epoll failure, errno is: %d", errno);
             break;
         }
         //循环遍历事件数组
         for (int i = 0; i < num; ++ i) {
-            int sockfd = events[i].data.fd;
-            if (sockfd == listenfd) {
-                
-                // 有客户端连接进来
+            // 连接的事件带的是句柄，低32位可能和这里的fd相同，交给reactor处理
+            int sockfd = conn_slab::is_handle(events[i].data.u64) ? -1 : events[i].data.fd;
+            if (sockfd != -1 && sockfd == listenfd) {
+                // 有客户端连接进来，监听socket是ET模式，需要一直accept到EAGAIN
                 struct sockaddr_in client_address;
-                socklen_t clientaddrlen = sizeof(client_address);
-                // 传入式参数
-                int connectfd = accept(listenfd, (struct sockaddr*)&client_address, &clientaddrlen);
-                if ( connectfd < 0 ) {
-                    printf( "errno is: %d\n", errno );
-                    continue;
-                }
-
-                if (http_conn::m_user_count >= MAX_FD) {
-                    // 目前连接数量满了，应该给客户端提示
-                    // 给客户端一个信息，服务器正忙
-                    close(connectfd);
-                    continue;
+                int connectfd;
+                while ((connectfd = accept_conn(listenfd, client_address)) >= 0) {
+                    // 将这个描述符加入到数组中，将新的客户的数据初始化，放到数组中
+                    if (main_reactor) {
+                        main_reactor->add_conn(connectfd, client_address);
+                    } else {
+                        sub_reactors[next_reactor]->dispatch(connectfd, client_address);
+                        next_reactor = (next_reactor + 1) % sub_reactors.size();
+                    }
                 }
-
-                // 将这个描述符加入到数组中，将新的客户的数据初始化，放到数组中
-                requestArr[connectfd].init(connectfd, client_address, timer_lst);
-                
-            } else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
-                // 对方异常断开或者错误事件, 直接关闭连接，处理对应的事件
-
-                requestArr[sockfd].close_conn();
-
-            } 
+            }
             // pipefd[0]触发的读入事件
             else if ( (sockfd == pipefd[0]) && (events[i].events & EPOLLIN) )
             {
-                int sig;
                 char signals[1024];
                 ret = recv(pipefd[0], signals, sizeof(signals), 0);
                 if (ret == -1) continue;
@@ -200,43 +295,49 @@ int main(int argc, char * argv[])
                 else {
                     for (int i = 0; i < ret; ++ i) {
                         switch ( signals[i] ){
-                            case SIGALRM:
-                            // 用timeout变量标记有定时任务需要处理，但不立即处理定时任务
-                            // 这是因为定时任务的优先级不是很高，我们优先处理其他更重要的任务。
-                                timeout = true;
-                                break;
                             case SIGTERM:
                                 stop_server = true;
+                                break;
+                            case SIGUSR1:
+                                logger::set_level(logger::get_level() - 1);
+                                LOG_WARN("log level changed to %d", logger::get_level());
+                                break;
+                            case SIGUSR2:
+                                logger::set_level(logger::get_level() + 1);
+                                LOG_WARN("log level changed to %d", logger::get_level());
+                                break;
                         }
                     }
                 }
             }
-            else if (events[i].events & EPOLLIN) { 
-                if (requestArr[sockfd].read(epollfd ,timer_lst)) {
-                    // 一次性将所有的数据都读出来
-                    pool->append(requestArr + sockfd);
-                } else {
-                    requestArr[sockfd].close_conn();
-                }
-            }
-            else if (events[i].events & EPOLLOUT) // 写
-            {
-                if (!requestArr[sockfd].write()) {
-                    requestArr[sockfd].close_conn();
-                }
+            else if (main_reactor) {
+                // 连接上的读写事件以及timerfd
+                main_reactor->handle_event(events[i]);
             }
         }
         // 最后处理定时时间，因为I/0有更高的优先级
-        if (timeout) {
-            timer_handler();
-            timeout = false;
+        if (main_reactor) {
+            main_reactor->process_timers();
         }
     }
-    close(epollfd);
-    close(listenfd);
+    for (size_t i = 0; i < sub_reactors.size(); ++ i) {
+        delete sub_reactors[i];
+    }
+    for (size_t i = 0; i < uring_reactors.size(); ++ i) {
+        delete uring_reactors[i];
+    }
+    if (main_reactor) {
+        delete main_reactor;
+    } else {
+        close(epollfd);
+    }
+    delete [] events;
+    if (listenfd != -1) {
+        close(listenfd);
+    }
     close( pipefd[1] );
     close( pipefd[0] );
-    delete [] requestArr;
     delete pool;
+    logger::stop();
     return 0;
 }
\ No newline at end of file
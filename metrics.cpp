@@ -0,0 +1,187 @@
+#include "metrics.h"
+#include "locker.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// 一个线程的全部计数器。只有所属线程写，用relaxed的load + store代替原子加法，
+// 读取的线程看到的最多是稍旧的值
+struct alignas(64) metrics_shard {
+    std::atomic<uint64_t> counters[metrics::COUNTER_NUMBER];
+    std::atomic<uint64_t> status[metrics::STATUS_NUMBER];
+    std::atomic<uint64_t> buckets[metrics::HISTOGRAM_NUMBER][metrics::BUCKET_NUMBER];
+    std::atomic<uint64_t> sum_ns[metrics::HISTOGRAM_NUMBER];
+};
+
+static const char * counter_names[metrics::COUNTER_NUMBER][2] = {
+    { "webserver_accepted_connections_total", "Accepted connections." },
+    { "webserver_sent_bytes_total", "Bytes of response headers and bodies sent to clients." },
+    { "webserver_timer_expirations_total", "Connections closed by the idle or request timer." },
+    { "webserver_compressed_responses_total", "Responses served gzip or brotli encoded." },
+};
+static const char * histogram_names[metrics::HISTOGRAM_NUMBER][2] = {
+    { "webserver_parse_seconds", "Time spent parsing a complete request." },
+    { "webserver_queue_wait_seconds", "Time a connection waited in the thread pool queue." },
+};
+static const int status_codes[metrics::STATUS_NUMBER] = { 200, 400, 403, 404, 500, 0 };
+
+// 线程退出之后它的计数器仍然保留，汇总的结果不会变小
+static std::vector<metrics_shard *> shards;
+static locker shards_locker;
+static thread_local metrics_shard * local_shard = NULL;
+
+// 时间戳到纳秒的换算：ns = ticks * tick_mult >> 32
+static uint64_t tick_mult = 1ULL << 32;
+
+static metrics_shard * get_shard()
+{
+    if (!local_shard) {
+        metrics_shard * s = new metrics_shard;
+        memset((void *)s, 0, sizeof(*s));
+        shards_locker.lock();
+        shards.push_back(s);
+        shards_locker.unlock();
+        local_shard = s;
+    }
+    return local_shard;
+}
+
+static inline void bump(std::atomic<uint64_t> & c, uint64_t n)
+{
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+static uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void metrics::init()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    // 用20毫秒校准TSC的频率，现代CPU的TSC频率恒定，rdtsc比clock_gettime快得多
+    uint64_t ns0 = monotonic_ns();
+    uint64_t tsc0 = __rdtsc();
+    struct timespec wait = { 0, 20 * 1000000 };
+    nanosleep(&wait, NULL);
+    uint64_t ns = monotonic_ns() - ns0;
+    uint64_t ticks = __rdtsc() - tsc0;
+    if (ticks > 0) {
+        tick_mult = (uint64_t)(((unsigned __int128)ns << 32) / ticks);
+    }
+#endif
+}
+
+uint64_t metrics::now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return monotonic_ns();
+#endif
+}
+
+void metrics::add(counter c, uint64_t n)
+{
+    bump(get_shard()->counters[c], n);
+}
+
+void metrics::count_status(int status)
+{
+    int i = 0;
+    while (i < STATUS_NUMBER - 1 && status_codes[i] != status) {
+        ++ i;
+    }
+    bump(get_shard()->status[i], 1);
+}
+
+void metrics::observe(histogram h, uint64_t start)
+{
+    uint64_t ticks = now() - start;
+    if ((int64_t)ticks < 0) {
+        ticks = 0; // 线程在不同CPU之间迁移，TSC有微小的差别
+    }
+    uint64_t ns = (uint64_t)(((unsigned __int128)ticks * tick_mult) >> 32);
+    int bucket = 64 - __builtin_clzll(ns | 1) - 8;
+    if (bucket < 0) {
+        bucket = 0;
+    } else if (bucket >= BUCKET_NUMBER) {
+        bucket = BUCKET_NUMBER - 1;
+    }
+    metrics_shard * s = get_shard();
+    bump(s->buckets[h][bucket], 1);
+    bump(s->sum_ns[h], ns);
+}
+
+static void append(std::string & out, const char * format, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(std::string & out, const char * format, ...)
+{
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (len > 0) {
+        out.append(line, len < (int)sizeof(line) ? len : sizeof(line) - 1);
+    }
+}
+
+void metrics::render(std::string & out)
+{
+    uint64_t counters[COUNTER_NUMBER] = { 0 };
+    uint64_t status[STATUS_NUMBER] = { 0 };
+    uint64_t buckets[HISTOGRAM_NUMBER][BUCKET_NUMBER] = { { 0 } };
+    uint64_t sum_ns[HISTOGRAM_NUMBER] = { 0 };
+    shards_locker.lock();
+    for (size_t k = 0; k < shards.size(); ++ k) {
+        metrics_shard * s = shards[k];
+        for (int i = 0; i < COUNTER_NUMBER; ++ i) {
+            counters[i] += s->counters[i].load(std::memory_order_relaxed);
+        }
+        for (int i = 0; i < STATUS_NUMBER; ++ i) {
+            status[i] += s->status[i].load(std::memory_order_relaxed);
+        }
+        for (int h = 0; h < HISTOGRAM_NUMBER; ++ h) {
+            for (int i = 0; i < BUCKET_NUMBER; ++ i) {
+                buckets[h][i] += s->buckets[h][i].load(std::memory_order_relaxed);
+            }
+            sum_ns[h] += s->sum_ns[h].load(std::memory_order_relaxed);
+        }
+    }
+    shards_locker.unlock();
+
+    for (int i = 0; i < COUNTER_NUMBER; ++ i) {
+        append(out, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counter_names[i][0], counter_names[i][1],
+            counter_names[i][0], counter_names[i][0], (unsigned long long)counters[i]);
+    }
+    append(out, "# HELP webserver_requests_total Responses by status code.\n# TYPE webserver_requests_total counter\n");
+    for (int i = 0; i < STATUS_NUMBER; ++ i) {
+        if (status_codes[i]) {
+            append(out, "webserver_requests_total{code=\"%d\"} %llu\n", status_codes[i], (unsigned long long)status[i]);
+        } else {
+            append(out, "webserver_requests_total{code=\"other\"} %llu\n", (unsigned long long)status[i]);
+        }
+    }
+    for (int h = 0; h < HISTOGRAM_NUMBER; ++ h) {
+        const char * name = histogram_names[h][0];
+        append(out, "# HELP %s %s\n# TYPE %s histogram\n", name, histogram_names[h][1], name);
+        // Prometheus的桶是累计的：le为上界，包含所有更小的桶
+        uint64_t total = 0;
+        for (int i = 0; i < BUCKET_NUMBER - 1; ++ i) {
+            total += buckets[h][i];
+            append(out, "%s_bucket{le=\"%g\"} %llu\n", name, (double)(1ULL << (i + 8)) * 1e-9, (unsigned long long)total);
+        }
+        total += buckets[h][BUCKET_NUMBER - 1];
+        append(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)total);
+        append(out, "%s_sum %.9f\n%s_count %llu\n", name, sum_ns[h] * 1e-9, name, (unsigned long long)total);
+    }
+}
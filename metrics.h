@@ -0,0 +1,37 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <string>
+
+// 运行时统计：计数器和耗时直方图。每个线程第一次记录时分配自己的一组计数器(独占缓存行)，
+// 之后只由这个线程写，不加锁也不用原子加法，每次记录只有几纳秒，可以在生产环境一直开着。
+// 读取时把所有线程的计数器加起来，输出为Prometheus的文本格式。
+class metrics {
+public:
+    enum counter {
+        ACCEPTED_CONNECTIONS = 0,   // 接受的连接数
+        SENT_BYTES,                 // 发送给客户端的字节数(响应头和响应体)
+        TIMER_EXPIRATIONS,          // 因为超时而关闭的连接数
+        COMPRESSED_RESPONSES,       // 发送预压缩文件或者压缩结果的响应数
+        COUNTER_NUMBER
+    };
+    enum histogram {
+        PARSE_TIME = 0,             // 解析一个完整请求的耗时
+        QUEUE_WAIT,                 // 连接在线程池队列中等待的时间
+        HISTOGRAM_NUMBER
+    };
+    // 直方图的桶按2的幂划分：第i个桶的上界是2^(i+8)纳秒(256ns到约1.07s)，最后一个是+Inf
+    static const int BUCKET_NUMBER = 24;
+    static const int STATUS_NUMBER = 6; // 200、400、403、404、500以及其他
+
+    static void init(); // 启动时调用一次，校准时间戳计数器
+    static void add(counter c, uint64_t n = 1);
+    static void count_status(int status); // 按状态码统计响应数量
+    static uint64_t now(); // 当前时间戳，只用来计算耗时，单位由init()校准
+    static void observe(histogram h, uint64_t start); // 记录从start(now()的返回值)到现在的耗时
+    // 把所有线程的计数器汇总成Prometheus文本格式，追加到out
+    static void render(std::string & out);
+};
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <exception>
+#include <cstddef>
+#include <stdint.h>
+
+// 有界的多生产者多消费者无锁队列(Dmitry Vyukov的环形缓冲区算法)。
+// 每个槽带一个序号，生产者和消费者各自用CAS抢占位置，不需要加锁，入队也不会分配内存。
+// 槽的序号等于位置时表示可写，等于位置+1时表示可读；队列满时push返回false
+template< typename T >
+class mpmc_queue {
+public:
+    explicit mpmc_queue(size_t capacity) : m_buffer(NULL), m_capacity(capacity),
+    m_enqueue_pos(0), m_dequeue_pos(0)
+    {
+        if (capacity == 0) {
+            throw std::exception();
+        }
+        m_buffer = new cell[capacity];
+        for (size_t i = 0; i < capacity; ++ i) {
+            m_buffer[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+    ~mpmc_queue() {
+        delete [] m_buffer;
+    }
+
+    bool push(const T & data) {
+        cell * c;
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            c = &m_buffer[pos % m_capacity];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return false; // 队列已满
+            } else {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        c->data = data;
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T & data) {
+        cell * c;
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            c = &m_buffer[pos % m_capacity];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0) {
+                if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return false; // 队列为空
+            } else {
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        data = c->data;
+        c->seq.store(pos + m_capacity, std::memory_order_release); // 下一圈的生产者可以写入
+        return true;
+    }
+
+private:
+    struct cell {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    cell * m_buffer;
+    size_t m_capacity;
+    // 生产者和消费者的位置放在不同的缓存行，避免伪共享
+    alignas(64) std::atomic<size_t> m_enqueue_pos;
+    alignas(64) std::atomic<size_t> m_dequeue_pos;
+};
+
+#endif
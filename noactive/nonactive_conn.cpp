@@ -54,7 +54,9 @@ void addsig( int sig )
     sa.sa_handler = sig_handler;
     sa.sa_flags |= SA_RESTART;
     sigfillset( &sa.sa_mask );
-    assert( sigaction( sig, &sa, NULL ) != -1 );
+    int ret = sigaction( sig, &sa, NULL ); // 不能放在assert中，定义NDEBUG时不会执行
+    assert( ret != -1 );
+    (void)ret;
 }
 
 void timer_handler()
@@ -146,7 +148,6 @@ int main( int argc, char* argv[] ) {
                 timer_lst.add_timer( timer );
             } else if( ( sockfd == pipefd[0] ) && ( events[i].events & EPOLLIN ) ) {
                 // 处理信号
-                int sig;
                 char signals[1024];
                 ret = recv( pipefd[0], signals, sizeof( signals ), 0 );
                 if( ret == -1 ) {
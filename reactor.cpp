@@ -0,0 +1,281 @@
+#include "reactor.h"
+
+// 添加文件描述符到epoll中
+extern void addfd(int epollfd, int fd, bool oneshot, uint64_t data);
+
+int reactor::m_max_conns = MAX_FD;
+int reactor::m_max_events = MAX_EVENT_NUMBER;
+
+int create_listenfd(int port, int backlog, bool reuseport)
+{
+    int listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenfd < 0) {
+        return -1;
+    }
+
+    // 设置端口复用
+    int reuse = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (reuseport && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+        close(listenfd);
+        return -1;
+    }
+    // 响应由write()自己合并成一次sendmsg，不需要Nagle算法。否则流水线请求分几次到达时，
+    // 后一个小响应要等前一个的ACK，而客户端在收齐响应之前不发数据，要等延迟ACK(约40ms)。
+    // 接受的连接继承监听socket的这个选项，不需要每个连接再调用setsockopt
+    setsockopt(listenfd, IPPROTO_TCP, TCP_NODELAY, &reuse, sizeof(reuse));
+
+    // 绑定端口
+    struct sockaddr_in addr;
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(listenfd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(listenfd, backlog) < 0) {
+        close(listenfd);
+        return -1;
+    }
+    return listenfd;
+}
+
+int accept_conn(int listenfd, sockaddr_in & addr)
+{
+    while (true) {
+        socklen_t addrlen = sizeof(addr);
+        // accept4直接得到非阻塞的socket，省去一次fcntl
+        int connfd = accept4(listenfd, (struct sockaddr *)&addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (connfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOG_ERROR("accept failed, errno is: %d", errno);
+            }
+            return -1;
+        }
+        if (http_conn::m_user_count >= reactor::m_max_conns) {
+            // 目前连接数量满了，直接关闭，继续处理队列中的下一个连接
+            close(connfd);
+            continue;
+        }
+        return connfd;
+    }
+}
+
+reactor::reactor(threadpool<http_conn> * pool, bool inline_requests) :
+m_epollfd(-1), m_wakeupfd(-1), m_listenfd(-1), m_timerfd(-1), m_armed(0), m_timeout(false), m_running(false), m_stop(false),
+m_events(NULL), m_pool(pool), m_inline(inline_requests)
+{
+    m_epollfd = epoll_create(200);
+    if (m_epollfd < 0) {
+        throw std::exception();
+    }
+    m_wakeupfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakeupfd < 0) {
+        close(m_epollfd);
+        throw std::exception();
+    }
+    addfd(m_epollfd, m_wakeupfd, false, m_wakeupfd);
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timerfd < 0) {
+        close(m_wakeupfd);
+        close(m_epollfd);
+        throw std::exception();
+    }
+    addfd(m_epollfd, m_timerfd, false, m_timerfd);
+    m_events = new epoll_event[m_max_events];
+}
+
+reactor::~reactor()
+{
+    stop();
+    if (m_listenfd != -1) {
+        close(m_listenfd);
+    }
+    close(m_timerfd);
+    close(m_wakeupfd);
+    close(m_epollfd);
+    delete [] m_events;
+}
+
+bool reactor::listen_on(int port, int backlog)
+{
+    m_listenfd = create_listenfd(port, backlog, true);
+    if (m_listenfd < 0) {
+        return false;
+    }
+    addfd(m_epollfd, m_listenfd, false, m_listenfd);
+    return true;
+}
+
+bool reactor::start()
+{
+    if (pthread_create(&m_thread, NULL, worker, (void *)this) != 0) {
+        return false;
+    }
+    m_running = true;
+    return true;
+}
+
+void reactor::stop()
+{
+    if (!m_running) {
+        return;
+    }
+    m_stop = true;
+    uint64_t one = 1;
+    ::write(m_wakeupfd, &one, sizeof(one));
+    pthread_join(m_thread, NULL);
+    m_running = false;
+}
+
+void * reactor::worker(void * arg)
+{
+    reactor * r = (reactor *)arg;
+    r->loop();
+    return r;
+}
+
+void reactor::loop()
+{
+    while (!m_stop) {
+        int num = epoll_wait(m_epollfd, m_events, m_max_events, -1);
+        if (num < 0 && errno != EINTR) {
+            LOG_ERROR("epoll failure, errno is: %d", errno);
+            break;
+        }
+        for (int i = 0; i < num; ++ i) {
+            handle_event(m_events[i]);
+        }
+        process_timers();
+    }
+}
+
+void reactor::dispatch(int connfd, const sockaddr_in & addr)
+{
+    pending_conn conn;
+    conn.connfd = connfd;
+    conn.address = addr;
+    m_pending_locker.lock();
+    m_pending.push_back(conn);
+    m_pending_locker.unlock();
+    // 唤醒reactor线程，由它自己完成连接的初始化，保证连接和定时器只被一个线程修改
+    uint64_t one = 1;
+    ::write(m_wakeupfd, &one, sizeof(one));
+}
+
+void reactor::add_conn(int connfd, const sockaddr_in & addr)
+{
+    // 连接对象从本reactor的对象池中取，不需要为每个连接分配内存
+    m_conns.alloc()->init(connfd, addr, m_epollfd, m_timers, m_conns);
+}
+
+void reactor::handle_accept()
+{
+    // 监听socket是ET模式，一次EPOLLIN可能对应多个连接，必须一直accept到EAGAIN
+    struct sockaddr_in client_address;
+    int connfd;
+    while ((connfd = accept_conn(m_listenfd, client_address)) >= 0) {
+        add_conn(connfd, client_address);
+    }
+}
+
+void reactor::handle_pending()
+{
+    uint64_t count;
+    ::read(m_wakeupfd, &count, sizeof(count)); // ET模式，一次读取即可清空计数
+
+    std::vector<pending_conn> conns;
+    m_pending_locker.lock();
+    conns.swap(m_pending);
+    m_pending_locker.unlock();
+    for (size_t i = 0; i < conns.size(); ++ i) {
+        add_conn(conns[i].connfd, conns[i].address);
+    }
+}
+
+void reactor::handle_event(const epoll_event & event)
+{
+    if (conn_slab::is_handle(event.data.u64)) {
+        handle_conn_event(event);
+        return;
+    }
+    int sockfd = event.data.fd;
+    if (sockfd == m_timerfd) {
+        // 用m_timeout标记有定时任务需要处理，但不立即处理定时任务
+        // 这是因为定时任务的优先级不是很高，我们优先处理其他更重要的任务。
+        uint64_t expirations;
+        ::read(m_timerfd, &expirations, sizeof(expirations));
+        m_timeout = true;
+    } else if (sockfd == m_wakeupfd) {
+        handle_pending();
+    } else if (sockfd == m_listenfd) {
+        handle_accept();
+    }
+}
+
+void reactor::handle_conn_event(const epoll_event & event)
+{
+    http_conn * conn = m_conns.get(event.data.u64);
+    if (!conn) {
+        // 连接已经在这一轮之前的事件或定时器中关闭，槽可能已经被新连接复用，忽略这个过期的事件
+        return;
+    }
+    conn->sync_timer(); // 有事件说明工作线程已经交还连接，取回它设置的超时时间
+    if (event.events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        // 对方异常断开或者错误事件, 直接关闭连接
+        conn->close_conn();
+    } else if (event.events & EPOLLIN) {
+        if (conn->is_closing()) {
+            // 等待客户端关闭的连接，只丢弃收到的数据
+            if (!conn->read()) {
+                conn->close_conn();
+            }
+        } else if (conn->read()) {
+            // 一次性将所有的数据都读出来，再处理其中的请求
+            handle_request(conn);
+        } else {
+            conn->close_conn();
+        }
+    } else if (event.events & EPOLLOUT) { // 写
+        if (!conn->write()) {
+            conn->close_conn();
+        } else if (conn->has_buffered_request()) {
+            // 流水线中还有没处理的请求，此时连接没有注册任何事件，由这里直接处理
+            handle_request(conn);
+        }
+    }
+}
+
+// 小文件命中缓存时在本线程中解析并发送响应，省去交给线程池再取回的两次线程切换；
+// 需要读文件或者发送大文件的请求交给线程池。请求队列已满时服务器过载，直接关闭连接
+void reactor::handle_request(http_conn * conn)
+{
+    if (m_inline && conn->process_inline()) {
+        return;
+    }
+    conn->mark_dispatched();
+    if (!m_pool->append(conn)) {
+        conn->close_conn();
+    }
+}
+
+void reactor::process_timers()
+{
+    if (m_timeout) {
+        m_timers.tick();
+        m_timeout = false;
+        m_armed = 0; // timerfd是一次性的，触发之后需要重新设置
+    }
+    // 时间轮中最近的到期时间有变化时才调用timerfd_settime
+    time_t next = m_timers.next_expire();
+    if (next == m_armed) {
+        return;
+    }
+    struct itimerspec its;
+    bzero(&its, sizeof(its));
+    its.it_value.tv_sec = next / 1000;
+    its.it_value.tv_nsec = (next % 1000) * 1000000;
+    timerfd_settime(m_timerfd, TFD_TIMER_ABSTIME, &its, NULL); // next为0时取消定时
+    m_armed = next;
+}
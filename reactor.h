@@ -0,0 +1,81 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <pthread.h>
+#include <vector>
+#include "locker.h"
+#include "threadpool.h"
+#include "http_conn.h"
+#include "timer_wheel.h"
+#include "conn_slab.h"
+
+#define MAX_FD 65535    // 默认的最大连接数量
+#define MAX_EVENT_NUMBER 10000 // 默认的一次监听的最大事件数目
+#define LISTEN_BACKLOG 128 // 默认的监听队列长度
+
+// 创建监听socket，reuseport为true时设置SO_REUSEPORT，多个socket可以绑定同一端口，由内核在它们之间分发连接
+int create_listenfd(int port, int backlog, bool reuseport);
+// 从listenfd上接受一个新连接，没有更多连接(EAGAIN)或出错时返回-1
+int accept_conn(int listenfd, sockaddr_in & addr);
+
+// one loop per thread: 每个reactor拥有一个epoll对象、一部分连接以及这些连接的定时器
+// 单reactor模式下由主线程直接驱动，多reactor模式下每个reactor运行在自己的线程中，
+// 由主线程accept之后通过dispatch()把新连接分发过来；
+// 分片监听模式下每个reactor通过listen_on()拥有自己的SO_REUSEPORT监听socket，各自accept
+class reactor {
+public:
+    // inline_requests为true时，只需要内存中缓存项的请求直接在reactor线程中处理，不交给线程池
+    reactor(threadpool<http_conn> * pool, bool inline_requests);
+    ~reactor();
+
+    static int m_max_conns; // 同时存在的连接数量上限，默认为MAX_FD，所有reactor共用
+    static int m_max_events; // 每次epoll_wait最多返回的事件数量，默认为MAX_EVENT_NUMBER，需要在创建reactor之前设置
+
+    int get_epollfd() {return m_epollfd;}
+    bool listen_on(int port, int backlog); // 创建本reactor独占的SO_REUSEPORT监听socket
+    bool start(); // 创建线程运行事件循环
+    void stop(); // 通知事件循环退出并等待线程结束
+
+    void dispatch(int connfd, const sockaddr_in & addr); // 其他线程投递新连接，线程安全
+    void add_conn(int connfd, const sockaddr_in & addr); // 在本reactor线程中接管新连接
+    void handle_event(const epoll_event & event); // 处理连接上的读写事件
+    void process_timers(); // 每轮事件处理完之后调用：处理到期的定时器并重新设置timerfd
+
+private:
+    static void * worker(void * arg);
+    void loop();
+    void handle_pending(); // 接管其他线程投递过来的连接
+    void handle_accept(); // 在自己的监听socket上循环accept，直到EAGAIN
+    void handle_conn_event(const epoll_event & event); // 连接上的事件，按句柄找到连接
+    void handle_request(http_conn * conn); // 处理读缓冲区中的请求，必要时交给线程池
+
+    struct pending_conn {
+        int connfd;
+        sockaddr_in address;
+    };
+
+    int m_epollfd;
+    int m_wakeupfd; // eventfd，用于唤醒阻塞在epoll_wait上的reactor线程
+    int m_listenfd; // 分片监听模式下本reactor的监听socket，否则为-1
+    int m_timerfd; // 在时间轮中最近的到期时间触发，注册在本reactor的epoll对象中
+    time_t m_armed; // timerfd当前设置的到期时间，0表示未设置
+    bool m_timeout; // timerfd已经触发，定时器留到本轮IO事件处理完之后再处理
+    pthread_t m_thread;
+    bool m_running;
+    volatile bool m_stop;
+
+    epoll_event * m_events;
+    conn_slab m_conns; // 本reactor上的所有连接，按epoll事件中的句柄查找，不再以fd为下标
+    timer_wheel m_timers; // 本reactor上所有连接的定时器，嵌在m_conns的连接对象中，需要在m_conns之后声明，先于它销毁
+
+    threadpool<http_conn> * m_pool;
+    bool m_inline; // 小文件的请求在reactor线程中直接处理
+
+    std::vector<pending_conn> m_pending; // 等待接管的新连接
+    locker m_pending_locker;
+};
+
+#endif
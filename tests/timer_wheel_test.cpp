@@ -0,0 +1,64 @@
+// 时间轮的回归测试：用next_expire()驱动tick()，模拟reactor按timerfd/io_uring超时醒来，
+// 检查定时器都在到期的那一毫秒被处理。失败时返回非0，由ctest运行
+#include <stdio.h>
+#include "../http_conn.h"
+#include "../timer_wheel.h"
+
+static time_t now = 0;
+static time_t fired_at[2];
+static int failures = 0;
+
+static void record_cb(http_conn* user_data)
+{
+    fired_at[(long)user_data] = now;
+}
+
+static void check(bool ok, const char * what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        ++ failures;
+    }
+}
+
+// 上层的定时器在第0层转完一圈时才分配下来，而第0层在绕回之后的槽中还有定时器。
+// next_expire()必须先返回重新分配的时间，否则上层的定时器会一直等到那个槽才被处理
+static void test_cascade_before_wrapped_slot()
+{
+    timer_wheel wheel;
+    // 没有定时器时tick直接把时间轮拨到给定的时间，从一圈的起点开始
+    time_t base = (current_ms() | 255) + 1;
+    wheel.tick(base);
+
+    util_timer upper, wrapped;
+    upper.expire = base + 260; // 超过一圈，挂在第1层
+    upper.cb_func = record_cb;
+    upper.user_data = (http_conn*)0;
+    wheel.add_timer(&upper);
+
+    now = base + 200;
+    wheel.tick(now);
+    wrapped.expire = base + 455; // 不到一圈，挂在第0层，槽的下标在当前位置之前
+    wrapped.cb_func = record_cb;
+    wrapped.user_data = (http_conn*)1;
+    wheel.add_timer(&wrapped);
+
+    check(wheel.next_expire() == base + 256, "next_expire() returns the cascade point");
+
+    fired_at[0] = fired_at[1] = 0;
+    while (wheel.next_expire() != 0) {
+        now = wheel.next_expire();
+        wheel.tick(now);
+    }
+    check(fired_at[0] == upper.expire, "upper level timer fires on time");
+    check(fired_at[1] == wrapped.expire, "wrapped level 0 timer fires on time");
+}
+
+int main()
+{
+    test_cascade_before_wrapped_slot();
+    if (failures == 0) {
+        printf("timer_wheel_test passed\n");
+    }
+    return failures ? 1 : 0;
+}
@@ -5,118 +5,240 @@
 
 #include <iostream>
 #include <pthread.h>
-#include <list>
+#include <sched.h>
+#include <vector>
 #include "locker.h"
+#include "mpmc_queue.h"
+#include "metrics.h"
+#include "logger.h"
 #include <exception>
 #include <cstdio>
 
 using namespace std;
 
 // 使用模板类，线程池，为了代码的复用,参数T为任务类
+// 默认所有工作线程共用一个请求队列；work_stealing模式下每个工作线程有自己的队列，
+// 任务优先投递给上一次处理它的线程(T需要提供get_last_worker()/set_last_worker())，
+// 以复用该线程缓存中的连接数据，空闲的线程再从其他线程的队列中窃取任务。
+// T还需要提供get_enqueue_time()/set_enqueue_time()，用来统计任务在队列中等待的时间
 template< typename T >
 class threadpool {
 public:
-    threadpool(int thread_number = 8, int max_requests = 10000);
+    // cpus非空时，第i个工作线程绑定到cpus[i % cpus.size()]号CPU上
+    threadpool(int thread_number = 8, int max_requests = 10000, bool work_stealing = false,
+               const std::vector<int> & cpus = std::vector<int>());
     ~threadpool();
     bool append(T * request);
 
 private:
+    static const int SPIN_COUNT = 64; // 睡眠之前自旋检查队列的次数
+
+    // 每个请求队列以及在它上面睡眠的线程，单独占一个缓存行
+    struct alignas(64) worker_slot {
+        mpmc_queue<T*> * queue;
+        event_count queuestat;          // 用来在队列为空时让工作线程睡眠，有任务时唤醒
+        std::atomic<bool> idle;         // 对应的工作线程是否准备睡眠
+    };
+    struct worker_arg {
+        threadpool * pool;
+        int id;
+    };
+
     static void * worker(void * arg);
-    void run();
+    void run(int id);
+    // 取出一个任务：先取自己的队列，work_stealing模式下再从其他线程的队列窃取，
+    // 都为空时先自旋，再在futex上睡眠，线程池结束时返回NULL
+    T * take(int id);
+    T * try_take(int id);
+    void wake(int target); // 任务放入target的队列之后，唤醒能处理它的线程
+
     // 线程数量
     int m_thread_number;
 
     // 线程池数组，大小为m_thread_number;
     pthread_t * m_threads;
+    worker_arg * m_args;
 
     // 请求队列中最多允许的等待的数量
     int m_max_request;
 
-    //请求队列
-    std::list<T*> m_workqueue;
-
-    // 互斥锁
-    locker m_queuelocker;
-
-    // 信号量用来判断是否有任务需要处理
-    sem m_queuestat;
+    // 请求队列，无锁的有界环形队列，总容量就是m_max_request，队列满时append失败。
+    // 共享模式下只有一个，work_stealing模式下每个工作线程一个
+    std::vector<worker_slot> m_slots;
+    bool m_work_stealing;
+    std::atomic<unsigned> m_next; // 没有上一次处理线程的任务按轮询分配
 
     // 是否结束线程
-    bool m_stop;
+    std::atomic<bool> m_stop;
 
 };
 
 template< typename T >
-threadpool<T>::threadpool(int thread_number, int max_requests) : 
-m_thread_number(thread_number), m_threads(NULL), 
-m_max_request(max_requests), m_stop(false)
+threadpool<T>::threadpool(int thread_number, int max_requests, bool work_stealing, const std::vector<int> & cpus) :
+m_thread_number(thread_number), m_threads(NULL), m_args(NULL),
+m_max_request(max_requests), m_slots(work_stealing && thread_number > 0 ? thread_number : 1),
+m_work_stealing(work_stealing), m_next(0), m_stop(false)
 {
     if (thread_number <= 0  || max_requests <= 0) {
         throw std::exception();
     }
-    m_threads = new pthread_t[m_thread_number];
-    if (!m_threads) {
-        throw std::exception();
+    // work_stealing模式下总容量平分到每个线程的队列
+    int capacity = (max_requests + m_slots.size() - 1) / m_slots.size();
+    for (size_t i = 0; i < m_slots.size(); ++ i) {
+        m_slots[i].queue = new mpmc_queue<T*>(capacity);
+        m_slots[i].idle = false;
     }
+    m_threads = new pthread_t[m_thread_number];
+    m_args = new worker_arg[m_thread_number];
 
-    // 创建线程之后设置为线程detach
+    // 线程在析构时join，保证线程退出之后才释放队列
     for (int i = 0; i < thread_number; ++ i) {
-        printf("create the %dth thread \n", i);
-        if (pthread_create(&m_threads[i], NULL, worker, (void *)this ) != 0) {
+        LOG_DEBUG("create the %dth thread", i);
+        m_args[i].pool = this;
+        m_args[i].id = i;
+        if (pthread_create(&m_threads[i], NULL, worker, (void *)&m_args[i] ) != 0) {
+            m_stop = true;
+            for (size_t j = 0; j < m_slots.size(); ++ j) {
+                m_slots[j].queuestat.notify_all();
+            }
+            for (int j = 0; j < i; ++ j) {
+                pthread_join(m_threads[j], NULL);
+            }
+            for (size_t j = 0; j < m_slots.size(); ++ j) {
+                delete m_slots[j].queue;
+            }
             delete [] m_threads;
+            delete [] m_args;
             throw std::exception();
         }
-        if (pthread_detach(m_threads[i])){
-            delete [] m_threads;
-            throw std::exception();
+        if (!cpus.empty()) {
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(cpus[i % cpus.size()], &cpuset);
+            if (pthread_setaffinity_np(m_threads[i], sizeof(cpuset), &cpuset) != 0) {
+                LOG_WARN("bind the %dth thread to cpu %d failed", i, cpus[i % cpus.size()]);
+            }
         }
     }
 }
 
 template< typename T >
 threadpool<T> :: ~threadpool(){
-    delete m_threads;
     m_stop = true;
+    for (size_t i = 0; i < m_slots.size(); ++ i) {
+        m_slots[i].queuestat.notify_all();
+    }
+    for (int i = 0; i < m_thread_number; ++ i) {
+        pthread_join(m_threads[i], NULL);
+    }
+    for (size_t i = 0; i < m_slots.size(); ++ i) {
+        delete m_slots[i].queue;
+    }
+    delete [] m_threads;
+    delete [] m_args;
 }
 
 template< typename T >
 bool threadpool<T>::append(T * request) {
-    m_queuelocker.lock();
-    if (m_workqueue.size() > m_max_request) {
-        m_queuelocker.unlock();
-        return false;
+    int target = 0;
+    if (m_work_stealing) {
+        target = request->get_last_worker();
+        if (target < 0 || target >= m_thread_number) {
+            target = m_next.fetch_add(1, std::memory_order_relaxed) % m_thread_number;
+        }
+    }
+    request->set_enqueue_time(metrics::now());
+    // 目标队列满时依次尝试其他线程的队列，全部满了才失败
+    for (size_t i = 0; i < m_slots.size(); ++ i) {
+        int index = (target + i) % m_slots.size();
+        if (m_slots[index].queue->push(request)) {
+            wake(index);
+            return true;
+        }
+    }
+    // 队列已满，由调用者决定如何处理这个请求
+    return false;
+}
+
+template< typename T >
+void threadpool<T>::wake(int target) {
+    if (!m_work_stealing) {
+        m_slots[0].queuestat.notify_one(); // 有空闲线程在睡眠时才唤醒
+        return;
+    }
+    // 保证新放入的任务在读取idle标记之前可见，与take()中先设置idle再检查队列配对
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // 优先唤醒队列的主人，它在忙时唤醒一个空闲线程来窃取
+    for (int i = 0; i < m_thread_number; ++ i) {
+        int index = (target + i) % m_thread_number;
+        if (m_slots[index].idle.load()) {
+            m_slots[index].queuestat.notify_one();
+            return;
+        }
     }
-    // 可以处理这个问题
-    m_workqueue.push_back(request);
-    m_queuelocker.unlock();
-    m_queuestat.post(); // 信号量要增加
-    return true;
 }
 
 template< typename T >
 void * threadpool<T>::worker(void * arg) {
     // 静态无法访问当前的对象，可以将this传递过来
-    threadpool * pool = (threadpool *)arg;
-    pool->run();
-    return pool;
+    worker_arg * warg = (worker_arg *)arg;
+    warg->pool->run(warg->id);
+    return warg->pool;
 }
+
 template< typename T >
-void  threadpool<T>::run() {
-    while(!m_stop) {
-        m_queuestat.wait();
-        // 有数据进来了
-        m_queuelocker.lock();
-        
-        if (m_workqueue.empty()) {
-            m_queuelocker.unlock();
-            continue;
+T * threadpool<T>::try_take(int id) {
+    T * request = NULL;
+    int own = m_work_stealing ? id : 0;
+    if (m_slots[own].queue->pop(request)) {
+        return request;
+    }
+    if (m_work_stealing) {
+        for (int i = 1; i < m_thread_number; ++ i) {
+            if (m_slots[(id + i) % m_thread_number].queue->pop(request)) {
+                return request;
+            }
+        }
+    }
+    return NULL;
+}
+
+template< typename T >
+T * threadpool<T>::take(int id) {
+    worker_slot & slot = m_slots[m_work_stealing ? id : 0];
+    while (!m_stop) {
+        for (int i = 0; i < SPIN_COUNT; ++ i) {
+            T * request = try_take(id);
+            if (request) {
+                return request;
+            }
+        }
+        // 登记为等待者之后必须再检查一次所有队列，否则可能错过在这之间加入的任务
+        slot.idle = true;
+        unsigned key = slot.queuestat.prepare_wait();
+        T * request = try_take(id);
+        if (request || m_stop) {
+            slot.queuestat.cancel_wait();
+            slot.idle = false;
+            return request;
         }
-        T * request = m_workqueue.front();
-        m_workqueue.pop_front();
-        m_queuelocker.unlock();
+        slot.queuestat.wait(key);
+        slot.idle = false;
+    }
+    return NULL;
+}
+
+template< typename T >
+void  threadpool<T>::run(int id) {
+    while(!m_stop) {
+        T * request = take(id);
         if (!request) {
             continue;
         }
+        metrics::observe(metrics::QUEUE_WAIT, request->get_enqueue_time());
+        if (m_work_stealing) {
+            request->set_last_worker(id);
+        }
         // 处理任务的时候需要处理process，即写出process类
         request->process();
     }
@@ -127,4 +249,4 @@ void  threadpool<T>::run() {
 
 
 
-# endif
\ No newline at end of file
+# endif
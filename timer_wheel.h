@@ -0,0 +1,226 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <time.h>
+#include "http_conn.h"
+
+// 定时器使用的时间：单调时钟的毫秒数，不受系统时间调整的影响，和timerfd使用同一个时钟
+inline time_t current_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 分层时间轮，接口和语义与sort_timer_list相同，用来替代需要线性遍历的升序链表。
+// 时间单位为毫秒(current_ms())。第0层有256个槽，每个槽对应1ms；第1~4层各有64个槽，每个槽覆盖下一层一整圈的时间。
+// 定时器按超时时间挂在对应层的槽中，时间走到第0层的起点时把上一层对应槽中的定时器重新分配下来。
+// 添加、删除都是O(1)；延长超时时间时只修改expire，定时器仍留在原来的槽中，
+// 等原来的槽到期时发现还没有真正超时，再按新的expire重新挂到正确的位置(惰性延期)。
+// 定时器嵌在连接对象中，时间轮只负责把它们串起来，从不释放定时器。
+class timer_wheel {
+public:
+    timer_wheel() : m_count(0), m_next(0) {
+        m_current = current_ms();
+        for (int i = 0; i < TVR_SIZE; ++ i) {
+            init_slot(&m_tv1[i]);
+        }
+        for (int n = 0; n < TVN_LEVEL; ++ n) {
+            for (int i = 0; i < TVN_SIZE; ++ i) {
+                init_slot(&m_tvn[n][i]);
+            }
+        }
+    }
+    // 定时器属于连接对象，时间轮被销毁时不访问它们(连接对象可能已经先被释放)
+    ~timer_wheel() {
+    }
+
+    // 添加定时器
+    void add_timer(util_timer* timer) {
+        if (!timer) {
+            return;
+        }
+        insert(timer);
+        ++ m_count;
+        if (m_next && timer->expire < m_next) {
+            m_next = timer->expire < m_current ? m_current : timer->expire;
+        }
+    }
+
+    // 删除定时器，双向循环链表直接摘除即可。不在时间轮中的定时器(已经到期)不做处理
+    void del_timer(util_timer* timer) {
+        if (!timer || !timer->is_linked()) {
+            return;
+        }
+        unlink(timer);
+        -- m_count;
+    }
+
+    // 和sort_timer_list一样只考虑超时时间延长的情况。调用者修改expire之后什么都不需要做，
+    // 定时器所在的槽到期时会按新的expire重新挂到正确的位置
+    void adjust_timer(util_timer* timer) {
+    }
+
+    // 把超时时间改为expire。延长时同adjust_timer只修改expire；提前时立即挂到新的槽中，
+    // 否则要等到原来的槽到期才会处理
+    void mod_timer(util_timer* timer, time_t expire) {
+        if (!timer || !timer->is_linked()) {
+            return;
+        }
+        if (expire >= timer->expire) {
+            timer->expire = expire;
+            return;
+        }
+        unlink(timer);
+        timer->expire = expire;
+        insert(timer);
+        if (m_next && expire < m_next) {
+            m_next = expire < m_current ? m_current : expire;
+        }
+    }
+
+    // 处理所有到期的定时器：从时间轮中摘除，然后调用回调函数
+    void tick() {
+        tick(current_ms());
+    }
+
+    // 下一次需要tick的时间，没有定时器时返回0。第0层在本圈剩下的槽中有定时器时返回最近的那个槽，
+    // 否则返回第0层转完一圈、需要从上层重新分配定时器的时间。绕回之后的槽不能返回，
+    // 上层分配下来的定时器可能比它更早到期。结果会被缓存，
+    // 只有添加了更早的定时器或者tick之后才需要重新计算；删除定时器不更新，最多只是提前醒来一次
+    time_t next_expire() {
+        if (m_count == 0) {
+            return 0;
+        }
+        if (m_next == 0) {
+            m_next = (m_current | TVR_MASK) + 1;
+            for (int i = 0; i < TVR_SIZE - (m_current & TVR_MASK); ++ i) {
+                util_timer* head = &m_tv1[(m_current + i) & TVR_MASK];
+                if (head->next != head) {
+                    m_next = m_current + i;
+                    break;
+                }
+            }
+        }
+        return m_next;
+    }
+
+    // 以cur作为当前时间处理到期的定时器
+    void tick(time_t cur) {
+        m_next = 0;
+        if (m_count == 0) {
+            m_current = cur; // 没有定时器时直接把时间轮拨到当前时间
+            return;
+        }
+        while (m_current <= cur) {
+            int index = m_current & TVR_MASK;
+            // 第0层转完一圈，从上一层取出下一个槽的定时器重新分配，必要时逐层向上
+            if (!index && !cascade(0) && !cascade(1) && !cascade(2)) {
+                cascade(3);
+            }
+            // 先把整个槽摘到临时链表上，回调函数中添加或删除定时器都不会影响遍历
+            util_timer expired;
+            init_slot(&expired);
+            splice(&m_tv1[index], &expired);
+            // 先把时间轮拨到下一个槽再处理：回调中重新添加的已经到期的定时器(比如连接还在工作线程中时
+            // sync_timer()重新加入的定时器)挂到下一个槽，而不是刚摘下的这个槽，否则要等第0层转完一圈(256ms)
+            time_t now = m_current ++;
+            while (expired.next != &expired) {
+                util_timer* timer = expired.next;
+                unlink(timer);
+                if (timer->expire > now) {
+                    // 超时时间被延长过，重新挂到新的位置
+                    insert(timer);
+                    continue;
+                }
+                // 调用定时器回调，执行定时任务。定时器已经摘除，回调中可以释放它所在的连接对象
+                -- m_count;
+                timer->cb_func(timer->user_data);
+            }
+        }
+    }
+
+private:
+    static const int TVN_BITS = 6;
+    static const int TVR_BITS = 8;
+    static const int TVN_SIZE = 1 << TVN_BITS;
+    static const int TVR_SIZE = 1 << TVR_BITS;
+    static const int TVN_MASK = TVN_SIZE - 1;
+    static const int TVR_MASK = TVR_SIZE - 1;
+    static const int TVN_LEVEL = 4;
+    static const long long MAX_TVAL = (1LL << (TVR_BITS + TVN_LEVEL * TVN_BITS)) - 1;
+
+    // 槽是带哨兵头节点的双向循环链表
+    static void init_slot(util_timer* head) {
+        head->prev = head->next = head;
+    }
+    static void unlink(util_timer* timer) {
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
+        timer->prev = timer->next = NULL;
+    }
+    static void link_tail(util_timer* head, util_timer* timer) {
+        timer->prev = head->prev;
+        timer->next = head;
+        head->prev->next = timer;
+        head->prev = timer;
+    }
+    // 把from中的所有定时器移到空链表to中
+    static void splice(util_timer* from, util_timer* to) {
+        if (from->next == from) {
+            return;
+        }
+        to->next = from->next;
+        to->prev = from->prev;
+        to->next->prev = to;
+        to->prev->next = to;
+        init_slot(from);
+    }
+
+    // 根据超时时间与当前时间的差值决定定时器挂在哪一层的哪个槽上
+    void insert(util_timer* timer) {
+        time_t expire = timer->expire;
+        long long idx = (long long)expire - (long long)m_current;
+        util_timer* head;
+        if (idx < 0) {
+            // 已经超时的定时器放到下一个要处理的槽，m_current总是还没有处理的槽，tick()的回调中也是如此
+            head = &m_tv1[m_current & TVR_MASK];
+        } else if (idx < TVR_SIZE) {
+            head = &m_tv1[expire & TVR_MASK];
+        } else {
+            if (idx > MAX_TVAL) {
+                // 超出时间轮范围的定时器先放在最远的位置，到时候再重新分配
+                expire = m_current + MAX_TVAL;
+                idx = MAX_TVAL;
+            }
+            int level = 0;
+            while (level < TVN_LEVEL - 1 && idx >= (1LL << (TVR_BITS + (level + 1) * TVN_BITS))) {
+                ++ level;
+            }
+            head = &m_tvn[level][(expire >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK];
+        }
+        link_tail(head, timer);
+    }
+
+    // 把第level层当前槽中的定时器重新分配到下层，返回该槽的下标，为0表示上一层也需要分配
+    int cascade(int level) {
+        int index = (m_current >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK;
+        util_timer moved;
+        init_slot(&moved);
+        splice(&m_tvn[level][index], &moved);
+        while (moved.next != &moved) {
+            util_timer* timer = moved.next;
+            unlink(timer);
+            insert(timer);
+        }
+        return index;
+    }
+
+    time_t m_current; // 时间轮当前走到的时间
+    int m_count; // 时间轮中定时器的数量
+    time_t m_next; // 缓存的下一次需要tick的时间，0表示需要重新计算
+    util_timer m_tv1[TVR_SIZE];
+    util_timer m_tvn[TVN_LEVEL][TVN_SIZE];
+};
+
+#endif
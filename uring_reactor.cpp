@@ -0,0 +1,556 @@
+#include "uring_reactor.h"
+#include "reactor.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+// 系统头文件太旧(没有multishot recv)时只编译出supported()返回false的版本
+#ifdef IORING_RECV_MULTISHOT
+
+// 请求的user_data: 高32位是连接句柄的代数，低32位中高8位是请求类型，低24位是连接在conn_slab中的下标
+// (连接数量不超过reactor::m_max_conns，配置时限制在24位以内)。监听socket和eventfd上的请求代数为0
+enum URING_OP {
+    OP_ACCEPT = 1,
+    OP_WAKEUP,
+    OP_RECV,
+    OP_SEND,
+    OP_POLL
+};
+static const int OP_SHIFT = 24;
+static const uint64_t OP_MASK = 0xffULL << OP_SHIFT;
+
+static inline uint64_t make_data(uint64_t handle, URING_OP op)
+{
+    return handle | ((uint64_t)op << OP_SHIFT);
+}
+
+static int sys_io_uring_setup(unsigned entries, io_uring_params * p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void * arg, size_t argsz)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void * arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// SINGLE_ISSUER + DEFER_TASKRUN: 只有reactor线程提交请求，完成事件只在它调用io_uring_enter等待时处理，
+// 不会在其他系统调用返回时插进来
+static const unsigned RING_FLAGS = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL |
+                                   IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+
+bool uring_reactor::supported()
+{
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = RING_FLAGS;
+    p.cq_entries = 2;
+    int fd = sys_io_uring_setup(1, &p);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = (p.features & IORING_FEAT_SINGLE_MMAP) && (p.features & IORING_FEAT_EXT_ARG);
+    // provided buffer ring需要5.19，multishot recv需要6.0，DEFER_TASKRUN需要6.1，能创建上面的ring就都满足
+    void * ring = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ok && ring != MAP_FAILED) {
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (uint64_t)ring;
+        reg.ring_entries = 1;
+        reg.bgid = BUFFER_GROUP;
+        ok = sys_io_uring_register(fd, IORING_REGISTER_PBUF_RING, &reg, 1) == 0;
+    }
+    if (ring != MAP_FAILED) {
+        munmap(ring, 4096);
+    }
+    close(fd);
+    return ok;
+}
+
+uring_reactor::uring_reactor() :
+m_ringfd(-1), m_ring(MAP_FAILED), m_ring_size(0), m_sqes((io_uring_sqe *)MAP_FAILED), m_sqes_size(0),
+m_buf_ring((io_uring_buf_ring *)MAP_FAILED), m_buffers((char *)MAP_FAILED), m_buf_tail(0),
+m_listenfd(-1), m_own_listenfd(false), m_running(false), m_stop(false)
+{
+    m_wakeupfd = eventfd(0, EFD_CLOEXEC);
+    if (m_wakeupfd < 0) {
+        throw std::exception();
+    }
+}
+
+uring_reactor::~uring_reactor()
+{
+    stop();
+    if (m_own_listenfd) {
+        close(m_listenfd);
+    }
+    close(m_wakeupfd);
+    if (m_buffers != MAP_FAILED) {
+        munmap(m_buffers, RECV_BUFFER_COUNT * RECV_BUFFER_SIZE);
+    }
+    if (m_buf_ring != MAP_FAILED) {
+        munmap(m_buf_ring, RECV_BUFFER_COUNT * sizeof(io_uring_buf));
+    }
+    if (m_sqes != MAP_FAILED) {
+        munmap(m_sqes, m_sqes_size);
+    }
+    if (m_ring != MAP_FAILED) {
+        munmap(m_ring, m_ring_size);
+    }
+    if (m_ringfd != -1) {
+        close(m_ringfd);
+    }
+    for (size_t i = 0; i < m_send_states.size(); ++ i) {
+        delete [] m_send_states[i];
+    }
+}
+
+bool uring_reactor::listen_on(int port, int backlog)
+{
+    m_listenfd = create_listenfd(port, backlog, true);
+    m_own_listenfd = m_listenfd >= 0;
+    return m_own_listenfd;
+}
+
+void uring_reactor::share_listenfd(int listenfd)
+{
+    m_listenfd = listenfd;
+    m_own_listenfd = false;
+}
+
+bool uring_reactor::start()
+{
+    if (pthread_create(&m_thread, NULL, worker, (void *)this) != 0) {
+        return false;
+    }
+    m_running = true;
+    return true;
+}
+
+void uring_reactor::stop()
+{
+    if (!m_running) {
+        return;
+    }
+    m_stop = true;
+    uint64_t one = 1;
+    ::write(m_wakeupfd, &one, sizeof(one));
+    pthread_join(m_thread, NULL);
+    m_running = false;
+}
+
+void * uring_reactor::worker(void * arg)
+{
+    uring_reactor * r = (uring_reactor *)arg;
+    r->loop();
+    return r;
+}
+
+// SINGLE_ISSUER的ring属于创建它的线程，所以在reactor线程中创建
+bool uring_reactor::setup_ring()
+{
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = RING_FLAGS;
+    p.cq_entries = CQ_ENTRIES;
+    m_ringfd = sys_io_uring_setup(SQ_ENTRIES, &p);
+    if (m_ringfd < 0) {
+        return false;
+    }
+    // IORING_FEAT_SINGLE_MMAP: 提交队列和完成队列在同一个映射中
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    m_ring_size = sq_size > cq_size ? sq_size : cq_size;
+    m_ring = mmap(NULL, m_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_SQ_RING);
+    if (m_ring == MAP_FAILED) {
+        return false;
+    }
+    m_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe *)mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED) {
+        return false;
+    }
+    char * base = (char *)m_ring;
+    m_sq_head = (unsigned *)(base + p.sq_off.head);
+    m_sq_tail = (unsigned *)(base + p.sq_off.tail);
+    m_sq_array = (unsigned *)(base + p.sq_off.array);
+    m_sq_mask = *(unsigned *)(base + p.sq_off.ring_mask);
+    m_sq_entries = p.sq_entries;
+    m_cq_head = (unsigned *)(base + p.cq_off.head);
+    m_cq_tail = (unsigned *)(base + p.cq_off.tail);
+    m_cq_mask = *(unsigned *)(base + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe *)(base + p.cq_off.cqes);
+    // 提交队列项和数组下标一一对应，之后不再修改数组
+    for (unsigned i = 0; i < m_sq_entries; ++ i) {
+        m_sq_array[i] = i;
+    }
+    m_sq_pending = *m_sq_tail;
+    return true;
+}
+
+bool uring_reactor::setup_buffers()
+{
+    m_buf_ring = (io_uring_buf_ring *)mmap(NULL, RECV_BUFFER_COUNT * sizeof(io_uring_buf), PROT_READ | PROT_WRITE,
+                                           MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    m_buffers = (char *)mmap(NULL, RECV_BUFFER_COUNT * RECV_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                             MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (m_buf_ring == MAP_FAILED || m_buffers == MAP_FAILED) {
+        return false;
+    }
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)m_buf_ring;
+    reg.ring_entries = RECV_BUFFER_COUNT;
+    reg.bgid = BUFFER_GROUP;
+    if (sys_io_uring_register(m_ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return false;
+    }
+    for (int i = 0; i < RECV_BUFFER_COUNT; ++ i) {
+        recycle_buffer(i);
+    }
+    return true;
+}
+
+// 把缓冲区放回buffer ring的队尾，内核看到新的队尾之后就可以用它接收数据
+void uring_reactor::recycle_buffer(int bid)
+{
+    // C++中io_uring_buf_ring::bufs的偏移不是0(柔性数组前面的空结构体占了位置)，直接按数组访问，
+    // 第一项的resv字段就是tail
+    io_uring_buf * buf = (io_uring_buf *)m_buf_ring + (m_buf_tail & (RECV_BUFFER_COUNT - 1));
+    buf->addr = (uint64_t)(m_buffers + (size_t)bid * RECV_BUFFER_SIZE);
+    buf->len = RECV_BUFFER_SIZE;
+    buf->bid = bid;
+    ++ m_buf_tail;
+    __atomic_store_n(&m_buf_ring->tail, m_buf_tail, __ATOMIC_RELEASE);
+}
+
+io_uring_sqe * uring_reactor::get_sqe()
+{
+    unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    if (m_sq_pending - head >= m_sq_entries) {
+        // 提交队列满了，先把已经填好的请求交给内核，不等待完成事件
+        __atomic_store_n(m_sq_tail, m_sq_pending, __ATOMIC_RELEASE);
+        sys_io_uring_enter(m_ringfd, m_sq_pending - head, 0, 0, NULL, 0);
+        head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+        if (m_sq_pending - head >= m_sq_entries) {
+            return NULL;
+        }
+    }
+    io_uring_sqe * sqe = &m_sqes[m_sq_pending & m_sq_mask];
+    ++ m_sq_pending;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring_reactor::submit_and_wait(int timeout_ms)
+{
+    unsigned to_submit = m_sq_pending - *m_sq_tail;
+    __atomic_store_n(m_sq_tail, m_sq_pending, __ATOMIC_RELEASE);
+    __kernel_timespec ts;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+        arg.ts = (uint64_t)&ts;
+    }
+    return sys_io_uring_enter(m_ringfd, to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+void uring_reactor::reap()
+{
+    unsigned head = *m_cq_head;
+    unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        // 先复制出来再归还队列项，处理过程中提交请求不会影响它
+        io_uring_cqe cqe = m_cqes[head & m_cq_mask];
+        ++ head;
+        __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+        handle_cqe(cqe);
+    }
+}
+
+void uring_reactor::loop()
+{
+    if (!setup_ring() || !setup_buffers()) {
+        LOG_ERROR("io_uring setup failure, errno is: %d", errno);
+        return;
+    }
+    submit_accept();
+    submit_wakeup();
+    while (!m_stop) {
+        // 等待完成事件，最多等到时间轮中最近的定时器到期，不需要timerfd
+        int timeout = -1;
+        time_t next = m_timers.next_expire();
+        if (next) {
+            time_t now = current_ms();
+            timeout = next > now ? next - now : 0;
+        }
+        if (submit_and_wait(timeout) < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+            LOG_ERROR("io_uring failure, errno is: %d", errno);
+            break;
+        }
+        reap();
+        // 定时任务的优先级不高，所有完成事件处理完之后再处理
+        if (next && current_ms() >= next) {
+            m_timers.tick();
+        }
+    }
+}
+
+void uring_reactor::submit_accept()
+{
+    io_uring_sqe * sqe = get_sqe();
+    if (!sqe) {
+        LOG_WARN("io_uring submission queue full, stop accepting");
+        return;
+    }
+    // multishot accept: 一次提交，每个新连接产生一个完成事件。不取对方地址，多个完成事件会覆盖同一个地址缓冲区
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = make_data(0, OP_ACCEPT);
+}
+
+void uring_reactor::submit_wakeup()
+{
+    io_uring_sqe * sqe = get_sqe();
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m_wakeupfd;
+    sqe->addr = (uint64_t)&m_wakeup_value;
+    sqe->len = sizeof(m_wakeup_value);
+    sqe->user_data = make_data(0, OP_WAKEUP);
+}
+
+bool uring_reactor::submit_recv(http_conn * conn)
+{
+    io_uring_sqe * sqe = get_sqe();
+    if (!sqe) {
+        return false;
+    }
+    // multishot recv: 每次收到数据产生一个完成事件，数据放在内核从buffer ring中选出的缓冲区里
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->getfd();
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = make_data(conn->get_handle(), OP_RECV);
+    return true;
+}
+
+bool uring_reactor::submit_poll(http_conn * conn)
+{
+    io_uring_sqe * sqe = get_sqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = conn->getfd();
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data = make_data(conn->get_handle(), OP_POLL);
+    return true;
+}
+
+uring_reactor::send_state & uring_reactor::get_send_state(http_conn * conn)
+{
+    uint32_t index = (uint32_t)conn->get_handle();
+    while (index / conn_slab::CHUNK_SIZE >= m_send_states.size()) {
+        send_state * chunk = new send_state[conn_slab::CHUNK_SIZE];
+        memset(chunk, 0, sizeof(send_state) * conn_slab::CHUNK_SIZE);
+        m_send_states.push_back(chunk);
+    }
+    return m_send_states[index / conn_slab::CHUNK_SIZE][index % conn_slab::CHUNK_SIZE];
+}
+
+void uring_reactor::handle_cqe(const io_uring_cqe & cqe)
+{
+    URING_OP op = (URING_OP)((cqe.user_data & OP_MASK) >> OP_SHIFT);
+    if (op == OP_ACCEPT) {
+        if (cqe.res >= 0) {
+            add_conn(cqe.res);
+        } else if (cqe.res != -EINTR && cqe.res != -ECONNABORTED) {
+            LOG_ERROR("accept failed, errno is: %d", -cqe.res);
+        }
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            submit_accept(); // multishot请求已经结束(比如fd用完了)，重新提交
+        }
+        return;
+    }
+    if (op == OP_WAKEUP) {
+        if (!m_stop) {
+            submit_wakeup();
+        }
+        return;
+    }
+    // 接收数据用的缓冲区不管连接是否还在都要归还
+    int bid = -1;
+    if (op == OP_RECV && (cqe.flags & IORING_CQE_F_BUFFER)) {
+        bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+    }
+    // 连接已经关闭，槽可能已经被新连接复用，忽略这个过期的完成事件
+    http_conn * conn = m_conns.get(cqe.user_data & ~OP_MASK);
+    if (op == OP_RECV) {
+        handle_recv(cqe, conn);
+        if (bid >= 0) {
+            recycle_buffer(bid);
+        }
+        return;
+    }
+    if (!conn) {
+        return;
+    }
+    if (op == OP_SEND) {
+        if (cqe.res < 0) {
+            conn->close_conn();
+            return;
+        }
+        conn->complete_send(cqe.res);
+        if (conn->has_response()) {
+            handle_output(conn);
+        } else if (!conn->is_closing() && conn->has_pending_input()) {
+            process_input(conn); // 发送期间收到的流水线请求
+        }
+    } else if (op == OP_POLL) {
+        handle_output(conn);
+    }
+}
+
+void uring_reactor::add_conn(int connfd)
+{
+    if (http_conn::m_user_count >= reactor::m_max_conns) {
+        close(connfd);
+        return;
+    }
+    // multishot accept不带地址缓冲区(多个完成事件共用同一个请求，无法给每个连接一个缓冲区)，
+    // 客户端地址只有访问日志需要，开启时再用getpeername取得，每个连接多一次系统调用
+    sockaddr_in addr;
+    bzero(&addr, sizeof(addr));
+    if (logger::access_enabled()) {
+        socklen_t addrlen = sizeof(addr);
+        getpeername(connfd, (struct sockaddr *)&addr, &addrlen);
+    }
+    http_conn * conn = m_conns.alloc();
+    conn->init(connfd, addr, -1, m_timers, m_conns);
+    if (!submit_recv(conn)) {
+        conn->close_conn();
+    }
+}
+
+void uring_reactor::handle_recv(const io_uring_cqe & cqe, http_conn * conn)
+{
+    if (!conn) {
+        return;
+    }
+    if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS)) {
+        // 对方关闭连接或者出错
+        conn->close_conn();
+        return;
+    }
+    if (cqe.res > 0) {
+        int bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        if (!conn->append_data(m_buffers + (size_t)bid * RECV_BUFFER_SIZE, cqe.res)) {
+            conn->close_conn();
+            return;
+        }
+    }
+    // buffer ring用完(ENOBUFS)等情况下multishot请求会结束，需要重新提交
+    if (!(cqe.flags & IORING_CQE_F_MORE) && !submit_recv(conn)) {
+        conn->close_conn();
+        return;
+    }
+    // 正在发送响应时先只保存数据，这一批响应发送完之后再解析
+    if (cqe.res > 0 && !conn->has_response() && !conn->is_closing()) {
+        process_input(conn);
+    }
+}
+
+void uring_reactor::process_input(http_conn * conn)
+{
+    conn->process();
+    if (conn->has_response()) {
+        handle_output(conn);
+    }
+}
+
+void uring_reactor::handle_output(http_conn * conn)
+{
+    if (conn->sending_file()) {
+        // 没有sendfile请求，直接用非阻塞的sendfile发送，socket写满或者用完了发送配额时等待可写
+        if (!conn->write()) {
+            conn->close_conn();
+        } else if (conn->has_response()) {
+            if (!submit_poll(conn)) {
+                conn->close_conn();
+            }
+        } else if (!conn->is_closing() && conn->has_pending_input()) {
+            process_input(conn);
+        }
+        return;
+    }
+    send_state & state = get_send_state(conn);
+    int flags;
+    state.msg.msg_iov = state.iv;
+    state.msg.msg_iovlen = conn->prepare_send(state.iv, flags);
+    io_uring_sqe * sqe = get_sqe();
+    if (!sqe) {
+        conn->close_conn();
+        return;
+    }
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn->getfd();
+    sqe->addr = (uint64_t)&state.msg;
+    sqe->len = 1;
+    sqe->msg_flags = flags;
+    sqe->user_data = make_data(conn->get_handle(), OP_SEND);
+}
+
+#else
+
+bool uring_reactor::supported()
+{
+    return false;
+}
+
+uring_reactor::uring_reactor() : m_listenfd(-1), m_own_listenfd(false), m_wakeupfd(-1), m_running(false), m_stop(false)
+{
+}
+
+uring_reactor::~uring_reactor()
+{
+}
+
+bool uring_reactor::listen_on(int port, int backlog)
+{
+    return false;
+}
+
+void uring_reactor::share_listenfd(int listenfd)
+{
+}
+
+bool uring_reactor::start()
+{
+    return false;
+}
+
+void uring_reactor::stop()
+{
+}
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef URING_REACTOR_H
+#define URING_REACTOR_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <vector>
+#include "http_conn.h"
+#include "timer_wheel.h"
+#include "conn_slab.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+// io_uring后端的reactor，启动时用-u选择。和reactor一样每个线程一个，拥有自己的连接和时间轮。
+// 监听socket上提交一个multishot accept，每个连接提交一个multishot recv，数据由内核直接放进本reactor
+// 注册的provided buffer ring中，拷贝到连接的读缓冲区之后立刻归还，空闲的连接不占用接收缓冲区。
+// 响应用sendmsg请求发送；io_uring没有sendfile请求，大文件的内容仍然在reactor线程中用非阻塞的sendfile发送，
+// socket写满时提交poll请求等待可写。每一轮的请求在一次io_uring_enter中提交，同时等待完成事件和最近的定时器，
+// 稳定状态下不需要epoll_ctl重新注册事件。
+// 请求直接在reactor线程中解析并生成响应，不经过线程池：交给线程池之后还需要唤醒reactor才能提交发送请求，
+// 每个请求又多出一次系统调用，对静态文件来说得不偿失。
+class uring_reactor {
+public:
+    uring_reactor();
+    ~uring_reactor();
+
+    // 内核是否支持用到的io_uring功能(provided buffer ring、multishot accept/recv、DEFER_TASKRUN，6.1及以上)
+    static bool supported();
+    bool listen_on(int port, int backlog); // 创建本reactor独占的SO_REUSEPORT监听socket
+    void share_listenfd(int listenfd); // 和其他reactor一起在主线程创建的监听socket上accept
+    bool start(); // 创建线程运行事件循环
+    void stop(); // 通知事件循环退出并等待线程结束
+
+private:
+    static const unsigned SQ_ENTRIES = 256;
+    static const unsigned CQ_ENTRIES = 4096;
+    static const int RECV_BUFFER_COUNT = 512; // provided buffer的数量，必须是2的幂
+    static const int RECV_BUFFER_SIZE = 4096;
+    static const int BUFFER_GROUP = 0;
+
+    // 每个连接的sendmsg参数，在请求完成之前保持有效。和conn_slab一样按块分配，地址不会因为扩容而改变
+    struct send_state {
+        struct msghdr msg;
+        struct iovec iv[http_conn::MAX_PIPELINE * 2];
+    };
+
+    static void * worker(void * arg);
+    void loop();
+    bool setup_ring();
+    bool setup_buffers();
+    io_uring_sqe * get_sqe(); // 取一个空的提交队列项，队列满时先提交已有的请求
+    int submit_and_wait(int timeout_ms); // 提交所有请求并等待至少一个完成事件，timeout_ms为-1时不超时
+    void reap(); // 处理所有完成事件
+    void recycle_buffer(int bid);
+
+    void submit_accept();
+    void submit_wakeup();
+    bool submit_recv(http_conn * conn);
+    bool submit_poll(http_conn * conn);
+    void handle_cqe(const io_uring_cqe & cqe);
+    void add_conn(int connfd);
+    void handle_recv(const io_uring_cqe & cqe, http_conn * conn);
+    void process_input(http_conn * conn); // 解析读缓冲区中的请求，有响应时开始发送
+    void handle_output(http_conn * conn); // 发送还没发送完的响应
+    send_state & get_send_state(http_conn * conn);
+
+    int m_ringfd;
+    void * m_ring; // 提交队列和完成队列共用的映射
+    size_t m_ring_size;
+    io_uring_sqe * m_sqes;
+    size_t m_sqes_size;
+    unsigned * m_sq_head;
+    unsigned * m_sq_tail;
+    unsigned * m_sq_array;
+    unsigned m_sq_mask;
+    unsigned m_sq_entries;
+    unsigned m_sq_pending; // 已经填好还没有提交的请求的队尾
+    unsigned * m_cq_head;
+    unsigned * m_cq_tail;
+    unsigned m_cq_mask;
+    io_uring_cqe * m_cqes;
+
+    io_uring_buf_ring * m_buf_ring;
+    char * m_buffers;
+    unsigned short m_buf_tail;
+
+    int m_listenfd;
+    bool m_own_listenfd; // 监听socket是否由本reactor创建
+    int m_wakeupfd; // eventfd，stop()时唤醒事件循环
+    uint64_t m_wakeup_value;
+    pthread_t m_thread;
+    bool m_running;
+    volatile bool m_stop;
+
+    conn_slab m_conns; // 本reactor上的所有连接
+    timer_wheel m_timers; // 嵌在m_conns的连接对象中，需要在m_conns之后声明，先于它销毁
+    std::vector<send_state *> m_send_states; // 和m_conns的块一一对应
+};
+
+#endif